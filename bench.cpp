@@ -0,0 +1,182 @@
+// Benchmarks for the conversion and reduction pipeline. Every phase is timed
+// on its own over generated workloads of growing size and reported per AST
+// node, with the heap allocations it makes and the peak memory of the run.
+//
+// bench [max_n] runs every workload up to max_n nodes, 100000 by default
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "toposet_parser.hpp"
+#include "ulc_converter.hpp"
+#ifndef __EMSCRIPTEN__
+#include <sys/resource.h>
+#endif
+
+// every allocation goes through here so phases can report their count
+static size_t bench_allocations = 0;
+
+void *operator new(size_t size) {
+    bench_allocations++;
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// peak resident memory natively, the size of linear memory under wasm
+static double peak_memory_mib() {
+#ifdef __EMSCRIPTEN__
+    return __builtin_wasm_memory_size(0) * 65536.0 / (1 << 20);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+// \f.\x.f (f (... (f x)))
+static std::string church(size_t n) {
+    std::string out = "\\f.\\x.";
+    for (size_t i = 1; i < n; i++)
+        out += "f (";
+    out += "f x";
+    out.append(n - 1, ')');
+    return out;
+}
+
+// \x0.\x1. ... \xn.x0
+static std::string nested(size_t n) {
+    std::string out;
+    for (size_t i = 0; i < n; i++)
+        out += "\\x" + std::to_string(i) + ".";
+    return out + "x0";
+}
+
+// \x.x x ... x
+static std::string wide(size_t n) {
+    std::string out = "\\x.x";
+    for (size_t i = 1; i < n; i++)
+        out += " x";
+    return out;
+}
+
+// closed term of about budget nodes, nesting is capped so the generator
+// itself stays shallow
+static void random_term(std::mt19937 &rng, size_t budget, int bound,
+                        int depth, std::string &out) {
+    if (bound > 0 && (budget <= 1 || depth > 48)) {
+        out += "v" + std::to_string(rng() % bound);
+        return;
+    }
+    if (bound == 0 || rng() % 3 == 0) {
+        out += "\\v" + std::to_string(bound) + ".";
+        random_term(rng, budget - 1, bound + 1, depth + 1, out);
+        return;
+    }
+    size_t left = 1 + rng() % (budget - 1);
+    out += "(";
+    random_term(rng, left, bound, depth + 1, out);
+    out += ") (";
+    random_term(rng, budget - left, bound, depth + 1, out);
+    out += ")";
+}
+
+static std::string random_terms(size_t n) {
+    std::mt19937 rng(42);
+    std::string out;
+    random_term(rng, n, 0, 0, out);
+    return out;
+}
+
+struct bench_result {
+    double ns = 0;
+    size_t allocations = 0;
+};
+
+// runs setup then the timed phase reps times, keeping the fastest run and
+// the allocations of the last
+template <typename Setup, typename Phase>
+bench_result measure(size_t reps, Setup &&setup, Phase &&phase) {
+    bench_result result;
+    result.ns = 1e300;
+    for (size_t i = 0; i < reps; i++) {
+        setup();
+        size_t allocations = bench_allocations;
+        auto start = std::chrono::steady_clock::now();
+        phase();
+        auto end = std::chrono::steady_clock::now();
+        result.allocations = bench_allocations - allocations;
+        result.ns = std::min(
+            result.ns,
+            std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    return result;
+}
+
+static void report(const char *workload, size_t n, const char *phase,
+                   size_t nodes, const bench_result &result) {
+    std::cout << std::left << std::setw(8) << workload << std::right
+              << std::setw(8) << n << "  " << std::left << std::setw(14)
+              << phase << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << result.ns / nodes << " ns/node"
+              << std::setw(10) << result.allocations << " allocs"
+              << std::endl;
+}
+
+static void run(const char *workload, size_t n, const std::string &text) {
+    ULC_converter converter(text);
+    size_t nodes = std::max<size_t>(converter.ast_.nodes_.size(), 1);
+    size_t reps = std::clamp<size_t>(1000000 / std::max<size_t>(n, 1), 1, 50);
+    auto none = [] {};
+
+    std::vector<ULC_token> tokens;
+    report(workload, n, "lex", nodes,
+           measure(reps, none, [&] { ULC_lexer(text).tokenize(tokens); }));
+
+    auto reset = [&] {
+        converter.ast_.clear();
+        converter.parser_.reset(ULC_lexer(text));
+        converter.ast_.nodes_.reserve(converter.parser_.tokens_.size());
+    };
+    report(workload, n, "parse", nodes,
+           measure(reps, reset, [&] { converter.parser_.parse(); }));
+
+    auto clear = [&] { converter.clear_store(); };
+    report(workload, n, "convert_dbj", nodes,
+           measure(reps, clear, [&] { converter.convert_dbj(); }));
+    SLC_set slc;
+    report(workload, n, "convert", nodes,
+           measure(reps, clear, [&] { slc = converter.convert(); }));
+
+    std::string out;
+    report(workload, n, "to_string", nodes,
+           measure(reps, none, [&] { out = slc.to_string(); }));
+
+    report(workload, n, "parse_toposet", nodes,
+           measure(reps, none, [&] {
+               toposet_parser parser(out);
+               parser.parse_toposet();
+           }));
+    std::cout << "peak memory " << std::setprecision(1)
+              << peak_memory_mib() << " MiB" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    size_t max_n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    for (size_t n = 1000; n <= max_n; n *= 10) {
+        run("church", n, church(n));
+        run("nested", n, nested(n));
+        run("wide", n, wide(n));
+        run("random", n, random_terms(n));
+    }
+}
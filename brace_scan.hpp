@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+// vectorized structural pass over toposet text. Input is classified 64 bytes
+// at a time into bitmasks of opening braces, closing braces and separators
+// (braces, ',' and whitespace), one bit per byte. Everything else is part of
+// a leaf token such as a De Bruijn number or λ
+
+// the separator bytes, which every path of classify_block and the toposet
+// parser's own loops agree on
+inline bool brace_is_separator(char ch) {
+    return ch == '{' || ch == '}' || ch == ',' || ch == ' ' || ch == '\t' ||
+           ch == '\n' || ch == '\r';
+}
+
+struct brace_block {
+    std::uint64_t open;
+    std::uint64_t close;
+    std::uint64_t separator;
+};
+
+inline brace_block classify_block(const char *p) {
+    brace_block block;
+#if defined(__AVX2__)
+    std::uint64_t open[2], close[2], sep[2];
+    for (int i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(p + 32 * i));
+        __m256i o = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{'));
+        __m256i c = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'));
+        __m256i s = _mm256_or_si256(
+            _mm256_or_si256(o, c),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))));
+        __m256i ws = _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+        s = _mm256_or_si256(s, ws);
+        open[i] = static_cast<std::uint32_t>(_mm256_movemask_epi8(o));
+        close[i] = static_cast<std::uint32_t>(_mm256_movemask_epi8(c));
+        sep[i] = static_cast<std::uint32_t>(_mm256_movemask_epi8(s));
+    }
+    block.open = open[0] | open[1] << 32;
+    block.close = close[0] | close[1] << 32;
+    block.separator = sep[0] | sep[1] << 32;
+#elif defined(__SSE2__)
+    block = {0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+        __m128i o = _mm_cmpeq_epi8(v, _mm_set1_epi8('{'));
+        __m128i c = _mm_cmpeq_epi8(v, _mm_set1_epi8('}'));
+        __m128i s = _mm_or_si128(
+            _mm_or_si128(o, c),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+        __m128i ws = _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        s = _mm_or_si128(s, ws);
+        int shift = 16 * i;
+        block.open |= static_cast<std::uint64_t>(_mm_movemask_epi8(o))
+                      << shift;
+        block.close |= static_cast<std::uint64_t>(_mm_movemask_epi8(c))
+                       << shift;
+        block.separator |= static_cast<std::uint64_t>(_mm_movemask_epi8(s))
+                           << shift;
+    }
+#elif defined(__wasm_simd128__)
+    block = {0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        v128_t v = wasm_v128_load(p + 16 * i);
+        v128_t o = wasm_i8x16_eq(v, wasm_i8x16_splat('{'));
+        v128_t c = wasm_i8x16_eq(v, wasm_i8x16_splat('}'));
+        v128_t s = wasm_v128_or(
+            wasm_v128_or(o, c),
+            wasm_v128_or(wasm_i8x16_eq(v, wasm_i8x16_splat(',')),
+                         wasm_i8x16_eq(v, wasm_i8x16_splat(' '))));
+        v128_t ws = wasm_v128_or(
+            wasm_i8x16_eq(v, wasm_i8x16_splat('\t')),
+            wasm_v128_or(wasm_i8x16_eq(v, wasm_i8x16_splat('\n')),
+                         wasm_i8x16_eq(v, wasm_i8x16_splat('\r'))));
+        s = wasm_v128_or(s, ws);
+        int shift = 16 * i;
+        block.open |= static_cast<std::uint64_t>(wasm_i8x16_bitmask(o))
+                      << shift;
+        block.close |= static_cast<std::uint64_t>(wasm_i8x16_bitmask(c))
+                       << shift;
+        block.separator |= static_cast<std::uint64_t>(wasm_i8x16_bitmask(s))
+                           << shift;
+    }
+#else
+    block = {0, 0, 0};
+    for (int i = 0; i < 64; i++) {
+        char ch = p[i];
+        std::uint64_t bit = std::uint64_t(1) << i;
+        if (ch == '{')
+            block.open |= bit;
+        if (ch == '}')
+            block.close |= bit;
+        if (brace_is_separator(ch))
+            block.separator |= bit;
+    }
+#endif
+    return block;
+}
+
+inline int popcount64(std::uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    int count = 0;
+    for (; x; x &= x - 1)
+        count++;
+    return count;
+#endif
+}
+
+inline int ctz64(std::uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    int count = 0;
+    for (; !(x & 1); x >>= 1)
+        count++;
+    return count;
+#endif
+}
+
+// calls visit(offset, block) for every 64 byte block of text. The final
+// partial block is padded with spaces, which are separators
+template <typename Visit>
+void scan_blocks(std::string_view text, Visit &&visit) {
+    size_t len = text.size();
+    size_t full = len & ~size_t(63);
+    for (size_t i = 0; i < full; i += 64)
+        visit(i, classify_block(text.data() + i));
+    if (full < len) {
+        char tail[64];
+        std::memset(tail, ' ', sizeof(tail));
+        std::memcpy(tail, text.data() + full, len - full);
+        visit(full, classify_block(tail));
+    }
+}
+
+struct brace_counts {
+    size_t open = 0;
+    size_t close = 0;
+    // leaf tokens, counted at the byte where each run of non separators
+    // starts
+    size_t leaves = 0;
+};
+
+inline brace_counts count_braces(std::string_view text) {
+    brace_counts counts;
+    std::uint64_t carry = 0;
+    scan_blocks(text, [&](size_t, const brace_block &block) {
+        std::uint64_t leaf = ~block.separator;
+        std::uint64_t starts = leaf & ~(leaf << 1 | carry);
+        carry = leaf >> 63;
+        counts.open += popcount64(block.open);
+        counts.close += popcount64(block.close);
+        counts.leaves += popcount64(starts);
+    });
+    return counts;
+}
+
+// calls visit(position, is_open) for every brace of text in order, using
+// the block masks so the bytes between braces are never branched on
+template <typename Visit>
+void for_each_brace(std::string_view text, Visit &&visit) {
+    scan_blocks(text, [&](size_t base, const brace_block &block) {
+        std::uint64_t braces = block.open | block.close;
+        while (braces) {
+            int bit = ctz64(braces);
+            visit(base + bit, (block.open >> bit & 1) != 0);
+            braces &= braces - 1;
+        }
+    });
+}
+
+// calls visit(position, depth) at the start of every set and leaf of the
+// first toposet in text, in order. depth counts the node itself and the sets
+// around it, so the root is 1. The brace and leaf start masks of the block
+// pass pick out the only bytes looked at and the running depth is carried
+// from block to block. Scanning stops once the root is closed
+template <typename Visit>
+void for_each_depth(std::string_view text, Visit &&visit) {
+    size_t depth = 0;
+    bool done = false;
+    std::uint64_t carry = 0;
+    scan_blocks(text, [&](size_t base, const brace_block &block) {
+        std::uint64_t leaf = ~block.separator;
+        std::uint64_t starts = leaf & ~(leaf << 1 | carry);
+        carry = leaf >> 63;
+        std::uint64_t marks = block.open | block.close | starts;
+        while (marks && !done) {
+            int bit = ctz64(marks);
+            std::uint64_t mask = std::uint64_t(1) << bit;
+            if (block.open & mask) {
+                visit(base + bit, ++depth);
+            } else if (block.close & mask) {
+                done = depth <= 1;
+                depth -= depth != 0;
+            } else {
+                visit(base + bit, depth + 1);
+            }
+            marks &= marks - 1;
+        }
+    });
+}
@@ -1,5 +1,10 @@
+#pragma once
+
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -31,3 +36,73 @@ inline const huffman_node &encoding_tree() {
 
     return tree;
 }
+
+// flat form of a two level encoding tree. A code is (digit, index), digit
+// picks a child of the root and index picks an entry inside it, so decoding
+// a leaf is two array lookups instead of a walk over nested variants
+struct huffman_table {
+    enum class kind { SYMBOL, NUMBER, LIST };
+    struct branch {
+        kind type;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+    using symbol = std::variant<std::monostate, std::string_view, int>;
+
+    std::vector<branch> branches;
+    std::vector<std::string_view> symbols;
+
+    // tree must outlive the table, symbols refer to its strings
+    explicit huffman_table(const huffman_node &tree) {
+        const auto &root = std::get<huffman_node::node_list>(tree.data);
+        for (const huffman_node &child : root) {
+            if (auto s = std::get_if<std::string>(&child.data)) {
+                branches.push_back(
+                    {kind::SYMBOL, static_cast<std::uint32_t>(symbols.size()),
+                     1});
+                symbols.push_back(*s);
+            } else if (std::holds_alternative<natural_numbers>(child.data)) {
+                branches.push_back({kind::NUMBER, 0, 0});
+            } else {
+                const auto &list =
+                    std::get<huffman_node::node_list>(child.data);
+                branches.push_back(
+                    {kind::LIST, static_cast<std::uint32_t>(symbols.size()),
+                     static_cast<std::uint32_t>(list.size())});
+                for (const huffman_node &leaf : list) {
+                    auto s = std::get_if<std::string>(&leaf.data);
+                    if (!s)
+                        throw std::runtime_error(
+                            "Encoding tree nested too deeply");
+                    symbols.push_back(*s);
+                }
+            }
+        }
+    }
+
+    // monostate if (digit, index) is not a code of the tree
+    symbol decode(size_t digit, size_t index) const {
+        if (digit >= branches.size())
+            return {};
+        const branch &b = branches[digit];
+        switch (b.type) {
+        case kind::SYMBOL:
+            if (index != 0)
+                return {};
+            return symbols[b.first];
+        case kind::NUMBER:
+            // De Bruijn indices start at 1
+            return natural_numbers{}[index + 1];
+        case kind::LIST:
+            if (index >= b.count)
+                return {};
+            return symbols[b.first + index];
+        }
+        return {};
+    }
+};
+
+inline const huffman_table &encoding_table() {
+    static const huffman_table table(encoding_tree());
+    return table;
+}
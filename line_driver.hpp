@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+// bulk conversion of newline separated inputs, such as a mapped_file, for
+// the command line modes of ulc2toposet and toposet_reducer. Lines are
+// handed to the worker in place as string_views, results are written to a
+// file descriptor in input order with writev, one output line per input line
+
+// input bytes a worker claims at a time, extended to the end of a line
+constexpr size_t line_chunk_bytes = 1 << 20;
+
+// chunks that may be converted ahead of the writer, per thread
+constexpr size_t line_chunk_window = 4;
+
+// writes every iovec in full, retrying partial writes
+inline void write_all(int fd, iovec *iov, size_t count) {
+    while (count) {
+        int batch = static_cast<int>(std::min<size_t>(count, IOV_MAX));
+        ssize_t written = writev(fd, iov, batch);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(std::string("Could not write output: ") +
+                                     std::strerror(errno));
+        }
+        size_t left = static_cast<size_t>(written);
+        while (count && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+}
+
+struct line_chunk {
+    std::string_view text;
+    std::string out = {};
+    // failures by line within the chunk
+    std::vector<std::pair<size_t, std::string>> errors = {};
+    size_t lines = 0;
+    bool done = false;
+};
+
+// runs worker(line, out) over every line of text, where make() builds one
+// worker per thread and worker appends the line's result to out. A line that
+// throws is reported on stderr with its number and left empty in the output.
+// threads = 0 uses every hardware thread. Returns the number of failed lines
+template <typename Make>
+size_t convert_lines(std::string_view text, int fd, unsigned threads,
+                     Make make) {
+    std::vector<line_chunk> chunks;
+    for (size_t pos = 0; pos < text.size();) {
+        size_t end = std::min(pos + line_chunk_bytes, text.size());
+        size_t newline = text.find('\n', end == 0 ? 0 : end - 1);
+        end = newline == std::string_view::npos ? text.size() : newline + 1;
+        chunks.push_back({text.substr(pos, end - pos)});
+        pos = end;
+    }
+
+    auto convert = [](auto &worker, line_chunk &chunk) {
+        std::string_view rest = chunk.text;
+        while (!rest.empty()) {
+            size_t newline = rest.find('\n');
+            std::string_view line = rest.substr(0, newline);
+            rest = newline == std::string_view::npos
+                       ? std::string_view()
+                       : rest.substr(newline + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            size_t mark = chunk.out.size();
+            try {
+                worker(line, chunk.out);
+            } catch (const std::runtime_error &e) {
+                chunk.out.resize(mark);
+                chunk.errors.emplace_back(chunk.lines, e.what());
+            }
+            chunk.out += '\n';
+            chunk.lines++;
+        }
+    };
+
+    size_t failed = 0;
+    size_t line = 1;
+    std::vector<iovec> iov;
+    // writes chunks [first, last) and releases their buffers
+    auto flush = [&](size_t first, size_t last) {
+        iov.clear();
+        for (size_t k = first; k < last; k++) {
+            line_chunk &chunk = chunks[k];
+            for (const auto &[index, message] : chunk.errors)
+                std::cerr << "line " << line + index << ": " << message
+                          << std::endl;
+            failed += chunk.errors.size();
+            line += chunk.lines;
+            if (!chunk.out.empty())
+                iov.push_back({chunk.out.data(), chunk.out.size()});
+        }
+        write_all(fd, iov.data(), iov.size());
+        for (size_t k = first; k < last; k++)
+            std::string().swap(chunks[k].out);
+    };
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, chunks.size()));
+    if (threads <= 1) {
+        auto worker = make();
+        for (size_t k = 0; k < chunks.size(); k++) {
+            convert(worker, chunks[k]);
+            flush(k, k + 1);
+        }
+        return failed;
+    }
+
+    // workers claim chunks in order but no further than the window ahead of
+    // the writer, which waits for the next chunk in line and writes every
+    // finished chunk after it in one go
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable drained;
+    size_t next = 0;
+    size_t written = 0;
+    bool stop = false;
+    std::exception_ptr error;
+    size_t window = line_chunk_window * threads;
+
+    auto work = [&]() {
+        try {
+            auto worker = make();
+            while (true) {
+                size_t k;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    drained.wait(lock, [&] {
+                        return stop || next < written + window;
+                    });
+                    if (stop || next == chunks.size())
+                        return;
+                    k = next++;
+                }
+                convert(worker, chunks[k]);
+                std::lock_guard<std::mutex> lock(mutex);
+                chunks[k].done = true;
+                ready.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+            stop = true;
+            ready.notify_all();
+            drained.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads);
+    for (unsigned t = 0; t < threads; t++)
+        pool.emplace_back(work);
+    try {
+        while (written < chunks.size()) {
+            size_t last;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] { return stop || chunks[written].done; });
+                if (stop)
+                    break;
+                last = written;
+                while (last < chunks.size() && chunks[last].done)
+                    last++;
+            }
+            flush(written, last);
+            std::lock_guard<std::mutex> lock(mutex);
+            written = last;
+            drained.notify_all();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+            error = std::current_exception();
+        stop = true;
+        drained.notify_all();
+    }
+    for (std::thread &t : pool)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+    return failed;
+}
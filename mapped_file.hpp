@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read only memory mapping of a whole file, exposed as a string_view so
+// parsers can work on it in place without copying
+struct mapped_file {
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+
+    mapped_file(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Could not open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Could not stat " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Could not map " + path);
+            }
+            data_ = static_cast<const char *>(addr);
+            madvise(addr, size_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+    ~mapped_file() {
+        if (data_)
+            munmap(const_cast<char *>(data_), size_);
+    }
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    std::string_view view() const { return {data_, size_}; }
+};
@@ -1,34 +1,270 @@
-#include <memory>
-#include <set>
-#include <sstream>
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <variant>
+#include <vector>
+
+// SLC sets are hash-consed into an SLC_store, structurally identical sets are
+// stored once and referred to by a 32 bit node index
+using SLC_id = std::uint32_t;
+
+struct SLC_ref {
+    SLC_id id;
+    bool operator==(const SLC_ref &other) const { return id == other.id; }
+};
 
 // define recursive SLC set
-struct SLC_set;
-using SLC_element =
-    std::variant<std::string_view, std::shared_ptr<SLC_set>, int>;
+using SLC_element = std::variant<std::string_view, SLC_ref, int>;
 
-struct SLC_set {
-    std::set<SLC_element> elements;
-    std::string to_string() {
-        std::ostringstream out;
-        out << "{";
-        for (auto it = elements.begin(); it != elements.end(); it++) {
-            auto elem = *it;
-            if (it != elements.begin())
-                out << ", ";
+// contiguous view over the elements of an interned set
+struct SLC_range {
+    const SLC_element *first;
+    const SLC_element *last;
+    const SLC_element *begin() const { return first; }
+    const SLC_element *end() const { return last; }
+    size_t size() const { return last - first; }
+};
+
+struct SLC_store {
+    struct node {
+        std::uint32_t offset;
+        std::uint32_t count;
+        std::uint64_t hash;
+        std::uint32_t depth;
+        std::uint64_t text_size;
+    };
+
+    std::vector<node> nodes_;
+    std::vector<SLC_element> elements_;
+    std::unordered_multimap<std::uint64_t, SLC_id> index_;
+    // sort buffer of intern
+    std::vector<SLC_element> scratch_;
+
+    SLC_range elements(SLC_id id) const {
+        const node &n = nodes_[id];
+        const SLC_element *first = elements_.data() + n.offset;
+        return {first, first + n.count};
+    }
+
+    size_t size() const { return nodes_.size(); }
+    std::uint64_t hash(SLC_id id) const { return nodes_[id].hash; }
+    std::uint32_t depth(SLC_id id) const { return nodes_[id].depth; }
+
+    // exact length of the text serialize() emits for id, cached at intern
+    // time so callers can allocate their output once
+    std::uint64_t serialized_size(SLC_id id) const {
+        return nodes_[id].text_size;
+    }
+
+    // canonical structural ordering of two interned sets. Sets are ordered by
+    // depth, size and hash first so almost every comparison exits without
+    // walking children, falling back to a lexicographic walk on hash
+    // collisions. Interned sets are equal exactly when their ids are
+    int compare(SLC_id a, SLC_id b) const {
+        if (a == b)
+            return 0;
+        const node &na = nodes_[a];
+        const node &nb = nodes_[b];
+        if (na.depth != nb.depth)
+            return na.depth < nb.depth ? -1 : 1;
+        if (na.count != nb.count)
+            return na.count < nb.count ? -1 : 1;
+        if (na.hash != nb.hash)
+            return na.hash < nb.hash ? -1 : 1;
+        SLC_range ea = elements(a);
+        SLC_range eb = elements(b);
+        for (size_t i = 0; i < ea.size(); i++) {
+            int c = compare(ea.first[i], eb.first[i]);
+            if (c != 0)
+                return c;
+        }
+        return 0;
+    }
+
+    // orders leaves before sets: strings, then sets, then ints
+    int compare(const SLC_element &a, const SLC_element &b) const {
+        if (a.index() != b.index())
+            return a.index() < b.index() ? -1 : 1;
+        if (std::holds_alternative<std::string_view>(a)) {
+            int c = std::get<std::string_view>(a).compare(
+                std::get<std::string_view>(b));
+            return c < 0 ? -1 : (c > 0 ? 1 : 0);
+        } else if (std::holds_alternative<int>(a)) {
+            int ia = std::get<int>(a);
+            int ib = std::get<int>(b);
+            return ia < ib ? -1 : (ia > ib ? 1 : 0);
+        }
+        return compare(std::get<SLC_ref>(a).id, std::get<SLC_ref>(b).id);
+    }
+
+    void clear() {
+        nodes_.clear();
+        elements_.clear();
+        index_.clear();
+    }
+
+    // returns the id of the set holding the count elements at elems,
+    // creating it if no structurally identical set has been interned yet.
+    // SLC sets are multisets so duplicate elements are kept. The elements
+    // are sorted in scratch_, which keeps its capacity, so a set that is
+    // already interned costs no allocation and elems may even point into
+    // elements_
+    SLC_id intern(const SLC_element *elems, size_t count) {
+        scratch_.assign(elems, elems + count);
+        std::sort(scratch_.begin(), scratch_.end(),
+                  [this](const SLC_element &a, const SLC_element &b) {
+                      return compare(a, b) < 0;
+                  });
+        std::uint64_t hash = hash_elements(scratch_.data(), count);
+
+        auto range = index_.equal_range(hash);
+        for (auto it = range.first; it != range.second; it++) {
+            SLC_range existing = elements(it->second);
+            if (std::equal(existing.begin(), existing.end(), scratch_.begin(),
+                           scratch_.end()))
+                return it->second;
+        }
+
+        std::uint32_t depth = 1;
+        // "{" + "}" + ", " between elements
+        std::uint64_t text_size = count == 0 ? 2 : 2 * count;
+        for (const SLC_element &elem : scratch_) {
+            if (std::holds_alternative<SLC_ref>(elem)) {
+                const node &child = nodes_[std::get<SLC_ref>(elem).id];
+                depth = std::max(depth, child.depth + 1);
+                text_size += child.text_size;
+            } else {
+                text_size += leaf_size(elem);
+            }
+        }
+
+        SLC_id id = static_cast<SLC_id>(nodes_.size());
+        nodes_.push_back({static_cast<std::uint32_t>(elements_.size()),
+                          static_cast<std::uint32_t>(count), hash, depth,
+                          text_size});
+        elements_.insert(elements_.end(), scratch_.begin(), scratch_.end());
+        index_.emplace(hash, id);
+        return id;
+    }
+
+    SLC_id intern(const std::vector<SLC_element> &elems) {
+        return intern(elems.data(), elems.size());
+    }
+
+    // writes the text of id through sink(const char *, size_t) in a single
+    // pass, using an explicit stack instead of recursion
+    template <typename Sink>
+    void serialize(SLC_id id, Sink &&sink) const {
+        struct frame {
+            SLC_id id;
+            std::uint32_t next;
+        };
+        std::vector<frame> stk;
+        stk.push_back({id, 0});
+        sink("{", 1);
+        while (!stk.empty()) {
+            frame &top = stk.back();
+            const node &n = nodes_[top.id];
+            if (top.next == n.count) {
+                sink("}", 1);
+                stk.pop_back();
+                continue;
+            }
+            if (top.next != 0)
+                sink(", ", 2);
+            const SLC_element &elem = elements_[n.offset + top.next];
+            top.next++;
+            if (std::holds_alternative<SLC_ref>(elem)) {
+                stk.push_back({std::get<SLC_ref>(elem).id, 0});
+                sink("{", 1);
+            } else {
+                write_leaf(elem, sink);
+            }
+        }
+    }
+
+    // appends the text of id to out, growing it at most once
+    void serialize(SLC_id id, std::string &out) const {
+        out.reserve(out.size() + serialized_size(id));
+        serialize(id, [&out](const char *data, size_t len) {
+            out.append(data, len);
+        });
+    }
+
+    std::string to_string(SLC_id id) const {
+        std::string out;
+        serialize(id, out);
+        return out;
+    }
+
+    // length of the text of a string or int element
+    static std::uint64_t leaf_size(const SLC_element &elem) {
+        if (std::holds_alternative<std::string_view>(elem))
+            return std::get<std::string_view>(elem).size();
+        char buf[16];
+        auto res = std::to_chars(buf, buf + sizeof(buf), std::get<int>(elem));
+        return res.ptr - buf;
+    }
+
+    // fixed 64 bit mixing so hashes do not depend on the standard library.
+    // Sets start from empty_hash and mix in each element's alternative
+    // index, then its characters, value or child hash
+    static constexpr std::uint64_t empty_hash = 0xcbf29ce484222325ULL;
+    static std::uint64_t mix(std::uint64_t h, std::uint64_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+
+  private:
+    template <typename Sink>
+    static void write_leaf(const SLC_element &elem, Sink &sink) {
+        if (std::holds_alternative<std::string_view>(elem)) {
+            std::string_view str = std::get<std::string_view>(elem);
+            sink(str.data(), str.size());
+            return;
+        }
+        char buf[16];
+        auto res = std::to_chars(buf, buf + sizeof(buf), std::get<int>(elem));
+        sink(buf, res.ptr - buf);
+    }
+
+    std::uint64_t hash_elements(const SLC_element *elems, size_t count) const {
+        std::uint64_t h = empty_hash;
+        for (const SLC_element &elem : SLC_range{elems, elems + count}) {
+            h = mix(h, elem.index());
             if (std::holds_alternative<std::string_view>(elem)) {
-                out << std::get<std::string_view>(elem);
+                for (char ch : std::get<std::string_view>(elem))
+                    h = mix(h, static_cast<unsigned char>(ch));
             } else if (std::holds_alternative<int>(elem)) {
-                out << std::get<int>(elem);
+                h = mix(h, static_cast<std::uint64_t>(std::get<int>(elem)));
             } else {
-                out << std::get<std::shared_ptr<SLC_set>>(elem)
-                           .get()
-                           ->to_string();
+                h = mix(h, nodes_[std::get<SLC_ref>(elem).id].hash);
             }
         }
-        out << "}";
-        return out.str();
+        return h;
+    }
+};
+
+// handle to an interned set, only valid while its store is alive
+struct SLC_set {
+    const SLC_store *store;
+    SLC_id id;
+
+    SLC_range elements() const { return store->elements(id); }
+    std::uint64_t hash() const { return store->hash(id); }
+    bool operator==(const SLC_set &other) const {
+        return store == other.store && id == other.id;
+    }
+    std::uint64_t serialized_size() const {
+        return store->serialized_size(id);
+    }
+    template <typename Sink> void serialize(Sink &&sink) const {
+        store->serialize(id, std::forward<Sink>(sink));
     }
+    std::string to_string() const { return store->to_string(id); }
 };
@@ -1,40 +1,482 @@
-const objectDepth = (o) => Object (o) === o ? 1 + Math.max(-1, ...Object.values(o).map(objectDepth)) : 0
-
-function parseSet(str) {
-    const stack = [[]];
-    let i = 0;
-    while (i < str.length) {
-        if (str[i] === '{') {
-            const next = [];
-            stack[stack.length - 1].push(next);
-            stack.push(next);
-        } else if (str[i] === '}') {
-            stack.pop();
-        }
-        i++;
-    }
-    return stack[0][0];
-}
-
-function generateNodes(set, depth) {
-	let div = document.createElement("span");
-	div.innerText = "";
-	div.classList.add((depth % 2 == 0) ? "a" : "b");
-	div.classList.add("box");
-	if (depth == 1) div.style.margin = "auto";
-	for (let i = 0; i < set.length; i++) {
-		div.appendChild(generateNodes(set[i], depth + 1));
-	}
-	return div;
+// words per node in the view and per box in the layout posted by the worker,
+// see toposet_flat.hpp and toposet_layout.hpp: kind, children, size, offset,
+// length and x, y, width, height
+const NODE_WORDS = 5;
+const BOX_WORDS = 4;
+// boxes smaller than this many css pixels are drawn as one block without
+// their subtree
+const MIN_BOX_PIXELS = 3;
+// fill of boxes at even and odd depths, and of the box under the pointer
+const COLORS = ["#e8e4dc", "#2a2a2a"];
+const HOVER_COLORS = ["#d44639", "#8f2814"];
+
+// { view, layout } of the topology on screen, null before the first result.
+// Box positions are relative to the parent box, see toposet_layout.hpp
+let topology = null;
+// layout units to css pixels, x and y are the layout point at the top left
+let camera = { x: 0, y: 0, scale: 1 };
+// true while the camera shows the whole topology as fit() left it
+let fitted = false;
+let hovered = -1;
+let frameRequested = false;
+// rectangles in layout units to redraw on the next frame, unless the whole
+// canvas is redrawn
+let damaged = [];
+let fullDraw = false;
+// rectangles of the visible boxes of each depth, reused across frames
+let layers = [];
+
+// redraws rects, given as layout space { x, y, w, h }, or everything
+function requestDraw(rects) {
+	if (rects === undefined) fullDraw = true;
+	else if (!fullDraw) for (let rect of rects) damaged.push(rect);
+	if (frameRequested) return;
+	frameRequested = true;
+	requestAnimationFrame(draw);
+}
+
+function draw() {
+	frameRequested = false;
+	let canvas = document.getElementById("canvas");
+	let ratio = window.devicePixelRatio || 1;
+	let width = canvas.clientWidth;
+	let height = canvas.clientHeight;
+	if (canvas.width != width * ratio || canvas.height != height * ratio) {
+		canvas.width = width * ratio;
+		canvas.height = height * ratio;
+		fullDraw = true;
+	}
+	let ctx = canvas.getContext("2d");
+	ctx.setTransform(ratio, 0, 0, ratio, 0, 0);
+	let rects = damaged;
+	let full = fullDraw || topology === null;
+	damaged = [];
+	fullDraw = false;
+	if (full) {
+		ctx.clearRect(0, 0, width, height);
+		if (topology !== null)
+			paint(ctx, 0, 0, width, height);
+		return;
+	}
+	let scale = camera.scale;
+	for (let rect of rects) {
+		// whole device pixels, so no edge is left half blended
+		let x0 = Math.max(0, Math.floor((rect.x - camera.x) * scale * ratio));
+		let y0 = Math.max(0, Math.floor((rect.y - camera.y) * scale * ratio));
+		let x1 = Math.min(canvas.width,
+			Math.ceil((rect.x + rect.w - camera.x) * scale * ratio));
+		let y1 = Math.min(canvas.height,
+			Math.ceil((rect.y + rect.h - camera.y) * scale * ratio));
+		if (x0 >= x1 || y0 >= y1) continue;
+		let px = x0 / ratio, py = y0 / ratio;
+		let pw = (x1 - x0) / ratio, ph = (y1 - y0) / ratio;
+		ctx.save();
+		ctx.beginPath();
+		ctx.rect(px, py, pw, ph);
+		ctx.clip();
+		ctx.clearRect(px, py, pw, ph);
+		paint(ctx, px, py, pw, ph);
+		ctx.restore();
+	}
+}
+
+// draws every box that meets the css pixel rectangle (px, py, pw, ph),
+// skipping subtrees outside it and collapsing those too small to see. Boxes
+// of one depth share a colour and lie above their parents, so each depth is
+// filled as a single path
+function paint(ctx, px, py, pw, ph) {
+	let view = topology.view;
+	let layout = topology.layout;
+	let count = view.length / NODE_WORDS;
+	let scale = camera.scale;
+	let left = camera.x + px / scale;
+	let top = camera.y + py / scale;
+	let right = left + pw / scale;
+	let bottom = top + ph / scale;
+	let minSize = MIN_BOX_PIXELS / scale;
+	for (let layer of layers) layer.length = 0;
+	let highlight = null;
+	// the open ancestors, where each subtree ends and its corner
+	let ends = [];
+	let xs = [];
+	let ys = [];
+	for (let i = 0; i < count;) {
+		while (ends.length > 0 && ends[ends.length - 1] <= i) {
+			ends.pop();
+			xs.pop();
+			ys.pop();
+		}
+		let depth = ends.length;
+		let b = i * BOX_WORDS;
+		let x = layout[b], y = layout[b + 1];
+		if (depth > 0) {
+			x += xs[depth - 1];
+			y += ys[depth - 1];
+		}
+		let w = layout[b + 2], h = layout[b + 3];
+		let size = view[i * NODE_WORDS + 2];
+		if (x > right || y > bottom || x + w < left || y + h < top) {
+			i += size;
+			continue;
+		}
+		if (layers.length <= depth) layers.push([]);
+		let rx = (x - camera.x) * scale, ry = (y - camera.y) * scale;
+		layers[depth].push(rx, ry, w * scale, h * scale);
+		if (i == hovered)
+			highlight = { depth: depth, rect: [rx, ry, w * scale, h * scale] };
+		if (w < minSize || h < minSize) {
+			i += size;
+			continue;
+		}
+		ends.push(i + size);
+		xs.push(x);
+		ys.push(y);
+		i++;
+	}
+
+	for (let depth = 0; depth < layers.length; depth++) {
+		let rects = layers[depth];
+		if (rects.length == 0) break;
+		// the root counts as depth 1, as the outermost box always did
+		ctx.fillStyle = COLORS[(depth + 1) % 2];
+		ctx.beginPath();
+		for (let k = 0; k < rects.length; k += 4)
+			ctx.rect(rects[k], rects[k + 1], rects[k + 2], rects[k + 3]);
+		ctx.fill();
+		if (highlight !== null && depth == highlight.depth) {
+			ctx.fillStyle = HOVER_COLORS[(depth + 1) % 2];
+			ctx.fillRect(...highlight.rect);
+		}
+	}
+}
+
+// deepest drawn box under the css pixel (px, py), -1 if there is none
+function pick(px, py) {
+	if (topology === null) return -1;
+	let view = topology.view;
+	let layout = topology.layout;
+	let x = camera.x + px / camera.scale;
+	let y = camera.y + py / camera.scale;
+	let minSize = MIN_BOX_PIXELS / camera.scale;
+	// the corner of the box picked so far
+	let cx = 0, cy = 0;
+	let inside = (i) => {
+		let b = i * BOX_WORDS;
+		let bx = cx + layout[b], by = cy + layout[b + 1];
+		return x >= bx && y >= by && x < bx + layout[b + 2] &&
+			y < by + layout[b + 3];
+	};
+	if (!inside(0)) return -1;
+	let node = 0;
+	while (true) {
+		let b = node * BOX_WORDS;
+		if (layout[b + 2] < minSize || layout[b + 3] < minSize) return node;
+		cx += layout[b];
+		cy += layout[b + 1];
+		let child = node + 1;
+		let next = -1;
+		for (let k = 0; k < view[node * NODE_WORDS + 1]; k++) {
+			if (inside(child)) {
+				next = child;
+				break;
+			}
+			child += view[child * NODE_WORDS + 2];
+		}
+		if (next < 0) return node;
+		node = next;
+	}
+}
+
+// shows the whole topology, centred in the canvas
+function fit() {
+	let canvas = document.getElementById("canvas");
+	let w = topology.layout[2];
+	let h = topology.layout[3];
+	let width = canvas.clientWidth;
+	let height = canvas.clientHeight;
+	camera.scale = 0.95 * Math.min(width / w, height / h);
+	camera.x = (w - width / camera.scale) / 2;
+	camera.y = (h - height / camera.scale) / 2;
+	fitted = true;
+}
+
+// layout space boxes of some nodes of a topology, found by walking down to
+// them only. targets are ascending indices, each gets { x, y, w, h, depth }
+// in order in .targets, and the outermost nodes of the index range [first,
+// last) get theirs in .range
+function locate(topo, targets, first, last) {
+	let view = topo.view;
+	let layout = topo.layout;
+	let count = view.length / NODE_WORDS;
+	let found = { targets: [], range: [] };
+	let ends = [];
+	let xs = [];
+	let ys = [];
+	// where the outermost open range node ends, 0 outside of one
+	let rangeEnd = 0;
+	let t = 0;
+	for (let i = 0; i < count;) {
+		while (ends.length > 0 && ends[ends.length - 1] <= i) {
+			ends.pop();
+			xs.pop();
+			ys.pop();
+		}
+		let depth = ends.length;
+		let b = i * BOX_WORDS;
+		let x = layout[b], y = layout[b + 1];
+		if (depth > 0) {
+			x += xs[depth - 1];
+			y += ys[depth - 1];
+		}
+		let box = { x: x, y: y, w: layout[b + 2], h: layout[b + 3],
+			depth: depth };
+		let size = view[i * NODE_WORDS + 2];
+		if (t < targets.length && targets[t] == i) {
+			found.targets.push(box);
+			t++;
+		}
+		if (i >= rangeEnd && i >= first && i < last) {
+			found.range.push(box);
+			rangeEnd = i + size;
+		}
+		// go into the subtree only if something wanted lies inside it. A
+		// target can sit below a range node when it moved to a new set
+		let want = t < targets.length ? targets[t] : count;
+		if (i + 1 >= rangeEnd && i + 1 < last)
+			want = Math.min(want, Math.max(first, i + 1));
+		if (want < i + size) {
+			ends.push(i + size);
+			xs.push(x);
+			ys.push(y);
+			i++;
+		} else {
+			i += size;
+		}
+	}
+	return found;
+}
+
+// the topology a worker reply describes, built from the current one and the
+// reply's changed range and patches
+function applyReply(result) {
+	let old = topology;
+	if (old === null || result.replace)
+		old = { view: new Uint32Array(0), layout: new Float32Array(0) };
+	let tail = old.view.length / NODE_WORDS - result.oldEnd;
+	let count = result.end + tail;
+	let view = new Uint32Array(count * NODE_WORDS);
+	let layout = new Float32Array(count * BOX_WORDS);
+	view.set(old.view.subarray(0, result.start * NODE_WORDS));
+	view.set(result.view, result.start * NODE_WORDS);
+	view.set(old.view.subarray(result.oldEnd * NODE_WORDS),
+		result.end * NODE_WORDS);
+	layout.set(old.layout.subarray(0, result.start * BOX_WORDS));
+	layout.set(result.layout, result.start * BOX_WORDS);
+	layout.set(old.layout.subarray(result.oldEnd * BOX_WORDS),
+		result.end * BOX_WORDS);
+	// text offsets of the unchanged tail
+	for (let i = result.end; i < count; i++)
+		view[i * NODE_WORDS + 3] += result.shift;
+	for (let k = 0; k < result.patches.length; k++) {
+		let i = result.patches[k];
+		view.set(result.patchView.subarray(k * NODE_WORDS,
+			(k + 1) * NODE_WORDS), i * NODE_WORDS);
+		layout.set(result.patchLayout.subarray(k * BOX_WORDS,
+			(k + 1) * BOX_WORDS), i * BOX_WORDS);
+	}
+	return { view: view, layout: layout };
+}
+
+// layout space rectangles that differ between the topologies before and
+// after a reply: the outermost boxes of the old and new changed ranges, and
+// for each patched node either its old and new box or, when only its size
+// changed, the strips between its old and new edges
+function damage(before, after, result) {
+	let grown = result.end - result.oldEnd;
+	let oldPatches = Array.from(result.patches,
+		(i) => i < result.start ? i : i - grown);
+	let a = locate(before, oldPatches, result.start, result.oldEnd);
+	let b = locate(after, result.patches, result.start, result.end);
+	let rects = a.range.concat(b.range);
+	for (let k = 0; k < a.targets.length; k++) {
+		let p = a.targets[k], q = b.targets[k];
+		if (p.x != q.x || p.y != q.y || p.depth != q.depth) {
+			rects.push(p, q);
+			continue;
+		}
+		let w = Math.min(p.w, q.w), h = Math.min(p.h, q.h);
+		let maxW = Math.max(p.w, q.w), maxH = Math.max(p.h, q.h);
+		if (w < maxW)
+			rects.push({ x: p.x + w, y: p.y, w: maxW - w, h: maxH });
+		if (h < maxH)
+			rects.push({ x: p.x, y: p.y + h, w: maxW, h: maxH - h });
+	}
+	return merge(rects);
+}
+
+// rects with pairs merged into their bounding box wherever that covers no
+// more than the two did, so the nested edges of the sets around an edit are
+// redrawn once without growing into area nothing changed in
+function merge(rects) {
+	let out = [];
+	for (let rect of rects) {
+		if (rect.w <= 0 || rect.h <= 0) continue;
+		let r = { x: rect.x, y: rect.y, w: rect.w, h: rect.h };
+		for (let k = 0; k < out.length;) {
+			let q = out[k];
+			let x = Math.min(r.x, q.x), y = Math.min(r.y, q.y);
+			let w = Math.max(r.x + r.w, q.x + q.w) - x;
+			let h = Math.max(r.y + r.h, q.y + q.h) - y;
+			if (w * h > r.w * r.h + q.w * q.h) {
+				k++;
+				continue;
+			}
+			r = { x: x, y: y, w: w, h: h };
+			out[k] = out[out.length - 1];
+			out.pop();
+			k = 0;
+		}
+		out.push(r);
+	}
+	return out;
+}
+
+// the wheel zooms around the pointer and dragging pans
+function setupCanvas() {
+	let canvas = document.getElementById("canvas");
+	let drag = null;
+	canvas.addEventListener("wheel", (e) => {
+		e.preventDefault();
+		let x = camera.x + e.offsetX / camera.scale;
+		let y = camera.y + e.offsetY / camera.scale;
+		camera.scale *= Math.exp(-e.deltaY * 0.002);
+		camera.x = x - e.offsetX / camera.scale;
+		camera.y = y - e.offsetY / camera.scale;
+		fitted = false;
+		requestDraw();
+	}, { passive: false });
+	canvas.addEventListener("mousedown", (e) => {
+		drag = { x: e.offsetX, y: e.offsetY };
+	});
+	window.addEventListener("mouseup", () => {
+		drag = null;
+	});
+	canvas.addEventListener("mousemove", (e) => {
+		if (drag !== null) {
+			camera.x -= (e.offsetX - drag.x) / camera.scale;
+			camera.y -= (e.offsetY - drag.y) / camera.scale;
+			drag = { x: e.offsetX, y: e.offsetY };
+			fitted = false;
+			requestDraw();
+			return;
+		}
+		let node = pick(e.offsetX, e.offsetY);
+		if (node != hovered) {
+			hovered = node;
+			requestDraw();
+		}
+	});
+	canvas.addEventListener("mouseleave", () => {
+		hovered = -1;
+		requestDraw();
+	});
+	window.addEventListener("resize", () => requestDraw());
+}
+
+window.addEventListener("load", setupCanvas);
+
+// conversions run in topology_worker.js, which keeps one session and lays
+// out its flat view with toposet_layout
+let worker = null;
+// requests sent to the worker and not yet answered, by id
+let pending = new Map();
+let latest = 0;
+// shared with the worker when cross origin isolated, the converter polls it
+// and gives up once it no longer holds the id it is working on
+let cancelFlag = null;
+// without the flag a busy worker cannot be stopped, so only the newest call
+// made meanwhile is kept, { id, text, resolve, reject }, and sent once the
+// worker answers
+let queued = null;
+
+function startWorker() {
+	worker = new Worker("topology_worker.js");
+	worker.onmessage = (e) => {
+		let request = pending.get(e.data.id);
+		// unknown id, nothing to answer
+		if (request === undefined) return;
+		pending.delete(e.data.id);
+		if (e.data.status == -2)
+			request.reject(new DOMException("Superseded", "AbortError"));
+		else if (e.data.status == -1) request.reject(new Error(e.data.error));
+		else request.resolve(e.data);
+		if (queued !== null && pending.size == 0) {
+			send(queued);
+			queued = null;
+		}
+	};
+	if (typeof SharedArrayBuffer !== "undefined" && self.crossOriginIsolated) {
+		cancelFlag = new Int32Array(new SharedArrayBuffer(4));
+		worker.postMessage({ flag: cancelFlag });
+	}
+}
+
+// converts text in the worker. The promise resolves to { status, dbj, slc,
+// ... } with the changes to the topology, see topology_worker.js, or rejects
+// with an AbortError once a newer call supersedes it. Status 0 means the text
+// did not change and nothing else is set
+function convertAsync(text) {
+	if (worker === null) startWorker();
+	let id = ++latest;
+	if (cancelFlag !== null) Atomics.store(cancelFlag, 0, id);
+	return new Promise((resolve, reject) => {
+		let request = { id: id, text: text, resolve: resolve, reject: reject };
+		if (cancelFlag !== null || pending.size == 0) {
+			send(request);
+			return;
+		}
+		// the worker keeps its module and session, the call it would have
+		// run next is dropped instead
+		if (queued !== null)
+			queued.reject(new DOMException("Superseded", "AbortError"));
+		queued = request;
+	});
+}
+
+function send(request) {
+	pending.set(request.id, request);
+	worker.postMessage({ id: request.id, text: request.text });
+}
+
+// shows a worker reply. Only the damaged rectangles are redrawn, unless the
+// topology is new or has to be fitted to the canvas again
+function render(result) {
+	if (result.status == 0) return;
+	document.getElementById("dbj").innerText = result.dbj;
+	document.getElementById("slc").innerText = result.slc;
+	let before = topology;
+	topology = applyReply(result);
+	if (before === null || result.replace) {
+		hovered = -1;
+		fit();
+		requestDraw();
+		return;
+	}
+	if (hovered >= result.oldEnd) hovered += result.end - result.oldEnd;
+	else if (hovered >= result.start) hovered = -1;
+	let resized = before.layout[2] != topology.layout[2] ||
+		before.layout[3] != topology.layout[3];
+	if (fitted && resized) {
+		fit();
+		requestDraw();
+		return;
+	}
+	requestDraw(damage(before, topology, result));
 }
 
 function generate() {
-	let container = document.getElementById("container");
 	let inp = document.getElementById("in").value;
-	let dbj = Module.ulc2dbj(inp);
-	let slc = Module.ulc2slc(inp);
-	document.getElementById("dbj").innerText = dbj;
-	document.getElementById("slc").innerText = slc;
-	container.innerHTML = "";
-	container.appendChild(generateNodes(parseSet(slc), 1));
+	convertAsync(inp).then(render, (e) => {
+		if (e.name != "AbortError") console.error(e);
+	});
 }
@@ -0,0 +1,109 @@
+// runs the wasm converter off the main thread, see convertAsync in
+// topology_generator.js. Requests are { id, text } and every one gets a reply
+// { id, status, ... } in order, status as returned by Session.try_update.
+// A changed topology is sent as the part of the view and layout that differs
+// from the one sent before, see toposet_damage in toposet_layout.hpp
+
+let session = null;
+let queue = [];
+// Int32Array on a SharedArrayBuffer holding the id of the newest request,
+// only available when the page is cross origin isolated
+let cancelFlag = null;
+let current = 0;
+// layouts sent so far by this worker's session
+let frames = 0;
+
+// words per node and per box, as in topology_generator.js
+const NODE_WORDS = 5;
+const BOX_WORDS = 4;
+
+// make release also builds a wasm simd variant into build/simd, used when
+// the browser validates this module, which splats and counts bits of a v128
+const SIMD_TEST = new Uint8Array([0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0,
+	1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11]);
+let directory = "build/";
+
+var Module = {
+	// the .wasm sits next to the script that was loaded, not the worker
+	locateFile: (path) => directory + path,
+	onRuntimeInitialized: () => {
+		session = new Module.Session();
+		run();
+	},
+	// polled by the converter every few thousand nodes
+	isCancelled: () =>
+		cancelFlag !== null && Atomics.load(cancelFlag, 0) !== current,
+};
+
+if (WebAssembly.validate(SIMD_TEST)) {
+	try {
+		directory = "build/simd/";
+		importScripts(directory + "ulc2toposet.js");
+	} catch (e) {
+		// not built, fall back to the plain module
+		directory = "build/";
+	}
+}
+if (directory == "build/") importScripts(directory + "ulc2toposet.js");
+
+onmessage = (e) => {
+	if (e.data.flag) {
+		cancelFlag = e.data.flag;
+		return;
+	}
+	queue.push(e.data);
+	run();
+};
+
+function run() {
+	if (session === null) return;
+	while (queue.length > 0) {
+		let { id, text } = queue.shift();
+		current = id;
+		// superseded before it started
+		let status = Module.isCancelled() ? -2 : session.try_update(text);
+		if (status <= 0) {
+			let error = status == -1 ? session.error() : "";
+			postMessage({ id: id, status: status, error: error });
+			continue;
+		}
+		// views alias wasm memory, so the changed words are copied out
+		// before anything else can allocate and grow it
+		let layout = session.layout();
+		let view = session.view();
+		let damage = session.damage();
+		let patches = damage.patches.slice();
+		let patchView = new Uint32Array(patches.length * NODE_WORDS);
+		let patchLayout = new Float32Array(patches.length * BOX_WORDS);
+		for (let k = 0; k < patches.length; k++) {
+			let i = patches[k];
+			patchView.set(view.subarray(i * NODE_WORDS, (i + 1) * NODE_WORDS),
+				k * NODE_WORDS);
+			patchLayout.set(layout.subarray(i * BOX_WORDS, (i + 1) * BOX_WORDS),
+				k * BOX_WORDS);
+		}
+		let rangeView = view.slice(damage.start * NODE_WORDS,
+			damage.end * NODE_WORDS);
+		let rangeLayout = layout.slice(damage.start * BOX_WORDS,
+			damage.end * BOX_WORDS);
+		postMessage({
+			id: id,
+			status: status,
+			dbj: session.dbj(),
+			slc: session.slc(),
+			// the first layout of a session is not relative to anything
+			// the page holds
+			replace: frames++ == 0,
+			start: damage.start,
+			oldEnd: damage.old_end,
+			end: damage.end,
+			shift: damage.shift,
+			view: rangeView,
+			layout: rangeLayout,
+			patches: patches,
+			patchView: patchView,
+			patchLayout: patchLayout,
+		}, [rangeView.buffer, rangeLayout.buffer, patches.buffer,
+			patchView.buffer, patchLayout.buffer]);
+	}
+}
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "brace_scan.hpp"
+#include "slc_set.hpp"
+
+// succinct balanced parentheses form of a toposet. Every node is an open bit
+// (1) and a close bit (0), 2 bits per node, in pre-order. Leaves of De Bruijn
+// sets (numbers and symbols such as λ) are "()" pairs flagged in a per-node
+// bitvector whose values live in a side table.
+//
+// Nodes are numbered by pre-order, node k starts at select1(k) and the node
+// starting at position p is rank1(p). Rank is a directory lookup plus one
+// popcount, select uses sampled positions and a short scan, and find_close
+// skips whole words through their minimum excess
+struct toposet_bp {
+    std::vector<std::uint64_t> words_;
+    size_t length_ = 0;
+
+    std::vector<std::uint64_t> leaf_words_;
+    size_t nodes_ = 0;
+    // positive values are De Bruijn numbers, -k refers to symbols_[k - 1]
+    std::vector<std::int32_t> leaf_values_;
+    std::vector<std::string> symbols_;
+
+    // directories, rebuilt by finish()
+    std::vector<std::uint32_t> rank_;
+    std::vector<std::uint32_t> leaf_rank_;
+    std::vector<std::uint32_t> select_;
+    std::vector<std::int8_t> word_min_;
+    std::vector<std::int8_t> word_excess_;
+
+    static constexpr size_t select_sample = 64;
+
+    void clear() {
+        words_.clear();
+        leaf_words_.clear();
+        leaf_values_.clear();
+        symbols_.clear();
+        length_ = 0;
+        nodes_ = 0;
+    }
+
+    // builder interface, nodes are appended in pre-order
+    void open() {
+        push_bit(true);
+        push_leaf_bit(false);
+    }
+    void close() { push_bit(false); }
+    void leaf(std::int32_t value) {
+        push_bit(true);
+        push_bit(false);
+        push_leaf_bit(true);
+        leaf_values_.push_back(value);
+    }
+    void leaf(std::string_view symbol) {
+        for (size_t i = 0; i < symbols_.size(); i++) {
+            if (symbols_[i] == symbol) {
+                leaf(-static_cast<std::int32_t>(i + 1));
+                return;
+            }
+        }
+        symbols_.emplace_back(symbol);
+        leaf(-static_cast<std::int32_t>(symbols_.size()));
+    }
+
+    // encodes an interned set, iteratively in element order
+    void encode(const SLC_store &store, SLC_id root) {
+        clear();
+        struct frame {
+            SLC_id id;
+            std::uint32_t next;
+        };
+        std::vector<frame> stk;
+        stk.push_back({root, 0});
+        open();
+        while (!stk.empty()) {
+            frame &top = stk.back();
+            SLC_range elems = store.elements(top.id);
+            if (top.next == elems.size()) {
+                close();
+                stk.pop_back();
+                continue;
+            }
+            const SLC_element &elem = elems.first[top.next++];
+            if (auto ref = std::get_if<SLC_ref>(&elem)) {
+                stk.push_back({ref->id, 0});
+                open();
+            } else if (auto number = std::get_if<int>(&elem)) {
+                leaf(*number);
+            } else {
+                leaf(std::get<std::string_view>(elem));
+            }
+        }
+        finish();
+    }
+
+    // builds the rank, select and excess directories
+    void finish() {
+        size_t words = words_.size();
+        rank_.assign(words + 1, 0);
+        word_min_.assign(words, 0);
+        word_excess_.assign(words, 0);
+        select_.clear();
+        size_t ones = 0;
+        for (size_t w = 0; w < words; w++) {
+            rank_[w] = static_cast<std::uint32_t>(ones);
+            std::uint64_t word = words_[w];
+            size_t bits = std::min<size_t>(64, length_ - 64 * w);
+            int excess = 0;
+            int min = 1;
+            for (size_t b = 0; b < bits; b++) {
+                if (word >> b & 1) {
+                    if (ones % select_sample == 0)
+                        select_.push_back(
+                            static_cast<std::uint32_t>(64 * w + b));
+                    ones++;
+                    excess++;
+                } else {
+                    excess--;
+                }
+                min = std::min(min, excess);
+            }
+            word_min_[w] = static_cast<std::int8_t>(min);
+            word_excess_[w] = static_cast<std::int8_t>(excess);
+        }
+        rank_[words] = static_cast<std::uint32_t>(ones);
+
+        leaf_rank_.assign(leaf_words_.size() + 1, 0);
+        size_t leaves = 0;
+        for (size_t w = 0; w < leaf_words_.size(); w++) {
+            leaf_rank_[w] = static_cast<std::uint32_t>(leaves);
+            leaves += popcount64(leaf_words_[w]);
+        }
+        leaf_rank_[leaf_words_.size()] = static_cast<std::uint32_t>(leaves);
+    }
+
+    size_t size() const { return nodes_; }
+    bool bit(size_t pos) const { return words_[pos / 64] >> (pos % 64) & 1; }
+
+    // open bits before pos
+    size_t rank1(size_t pos) const {
+        size_t w = pos / 64;
+        size_t b = pos % 64;
+        size_t r = rank_[w];
+        if (b)
+            r += popcount64(words_[w] & ((std::uint64_t(1) << b) - 1));
+        return r;
+    }
+
+    // position of the open bit of node k
+    size_t select1(size_t k) const {
+        size_t pos = select_[k / select_sample];
+        size_t remaining = k % select_sample;
+        size_t w = pos / 64;
+        std::uint64_t word = words_[w] & (~std::uint64_t(0) << (pos % 64));
+        while (true) {
+            size_t count = popcount64(word);
+            if (remaining < count)
+                break;
+            remaining -= count;
+            word = words_[++w];
+        }
+        for (; remaining; remaining--)
+            word &= word - 1;
+        return 64 * w + ctz64(word);
+    }
+
+    // position of the close bit matching the open bit at pos
+    size_t find_close(size_t pos) const {
+        int excess = 1;
+        size_t p = pos + 1;
+        // finish the current word bit by bit
+        while (p % 64 != 0) {
+            excess += bit(p) ? 1 : -1;
+            if (excess == 0)
+                return p;
+            p++;
+        }
+        // skip words that cannot bring the excess down to zero
+        size_t w = p / 64;
+        while (excess + word_min_[w] > 0) {
+            excess += word_excess_[w];
+            w++;
+        }
+        for (p = 64 * w;; p++) {
+            excess += bit(p) ? 1 : -1;
+            if (excess == 0)
+                return p;
+        }
+    }
+
+    bool is_leaf(size_t node) const {
+        return leaf_words_[node / 64] >> (node % 64) & 1;
+    }
+
+    // side table entry of a leaf node
+    std::int32_t leaf_value(size_t node) const {
+        size_t w = node / 64;
+        size_t b = node % 64;
+        size_t r = leaf_rank_[w];
+        if (b)
+            r += popcount64(leaf_words_[w] & ((std::uint64_t(1) << b) - 1));
+        return leaf_values_[r];
+    }
+
+    std::string_view leaf_symbol(std::int32_t value) const {
+        return symbols_[-value - 1];
+    }
+
+    // navigation by node number, npos when there is no such node
+    static constexpr size_t npos = SIZE_MAX;
+
+    size_t first_child(size_t node) const {
+        size_t pos = select1(node);
+        return bit(pos + 1) ? node + 1 : npos;
+    }
+
+    size_t next_sibling(size_t node) const {
+        size_t after = find_close(select1(node)) + 1;
+        return after < length_ && bit(after) ? rank1(after) : npos;
+    }
+
+    // nodes in the subtree of node, including itself
+    size_t subtree_size(size_t node) const {
+        size_t pos = select1(node);
+        return (find_close(pos) - pos + 1) / 2;
+    }
+
+    // serialized form: magic, counts, then every table as raw little endian
+    // words. Directories are rebuilt on load
+    std::string to_bytes() const {
+        std::string out("TPBP", 4);
+        auto put = [&out](const void *data, size_t len) {
+            out.append(static_cast<const char *>(data), len);
+        };
+        std::uint64_t header[4] = {length_, nodes_, leaf_values_.size(),
+                                   symbols_.size()};
+        put(header, sizeof(header));
+        put(words_.data(), words_.size() * sizeof(std::uint64_t));
+        put(leaf_words_.data(), leaf_words_.size() * sizeof(std::uint64_t));
+        put(leaf_values_.data(), leaf_values_.size() * sizeof(std::int32_t));
+        for (const std::string &symbol : symbols_) {
+            std::uint32_t len = static_cast<std::uint32_t>(symbol.size());
+            put(&len, sizeof(len));
+            put(symbol.data(), len);
+        }
+        return out;
+    }
+
+    // loads a serialized stream, throwing on anything to_bytes could not
+    // have written: sizes past the end of bytes, an unbalanced or forked
+    // tree, leaves that are not () pairs, a leaf count that differs from
+    // the side table and values naming no symbol
+    void from_bytes(std::string_view bytes) {
+        clear();
+        size_t pos = 4;
+        auto get = [&](void *data, size_t len) {
+            if (pos + len > bytes.size())
+                throw std::runtime_error("Truncated toposet bitstream");
+            if (len)
+                std::memcpy(data, bytes.data() + pos, len);
+            pos += len;
+        };
+        // whether count entries of size bytes are left, checked before
+        // anything is allocated for them
+        auto fits = [&](std::uint64_t count, size_t size) {
+            return count <= (bytes.size() - pos) / size;
+        };
+        if (bytes.substr(0, 4) != "TPBP")
+            throw std::runtime_error("Not a toposet bitstream");
+        std::uint64_t header[4];
+        get(header, sizeof(header));
+        std::uint64_t words = header[0] / 64 + (header[0] % 64 != 0);
+        std::uint64_t leaf_words = header[1] / 64 + (header[1] % 64 != 0);
+        if (!fits(words, sizeof(std::uint64_t)))
+            throw std::runtime_error("Truncated toposet bitstream");
+        length_ = header[0];
+        words_.resize(words);
+        get(words_.data(), words_.size() * sizeof(std::uint64_t));
+        if (!fits(leaf_words, sizeof(std::uint64_t)))
+            throw std::runtime_error("Truncated toposet bitstream");
+        nodes_ = header[1];
+        leaf_words_.resize(leaf_words);
+        get(leaf_words_.data(), leaf_words_.size() * sizeof(std::uint64_t));
+        if (!fits(header[2], sizeof(std::int32_t)))
+            throw std::runtime_error("Truncated toposet bitstream");
+        leaf_values_.resize(header[2]);
+        get(leaf_values_.data(), leaf_values_.size() * sizeof(std::int32_t));
+        // every symbol takes at least its length word
+        if (!fits(header[3], sizeof(std::uint32_t)))
+            throw std::runtime_error("Truncated toposet bitstream");
+        symbols_.resize(header[3]);
+        for (std::string &symbol : symbols_) {
+            std::uint32_t len;
+            get(&len, sizeof(len));
+            if (pos + len > bytes.size())
+                throw std::runtime_error("Truncated toposet bitstream");
+            symbol.assign(bytes.data() + pos, len);
+            pos += len;
+        }
+        // bits past the end are not part of the stream
+        if (length_ % 64)
+            words_.back() &= (std::uint64_t(1) << (length_ % 64)) - 1;
+        if (nodes_ % 64)
+            leaf_words_.back() &= (std::uint64_t(1) << (nodes_ % 64)) - 1;
+        validate();
+        finish();
+    }
+
+  private:
+    void validate() const {
+        if (nodes_ == 0 || length_ != 2 * nodes_)
+            throw std::runtime_error("Malformed toposet bitstream");
+        size_t excess = 0;
+        size_t node = 0;
+        size_t leaves = 0;
+        auto symbols = static_cast<std::int64_t>(symbols_.size());
+        for (size_t pos = 0; pos < length_; pos++) {
+            if (!bit(pos)) {
+                if (excess == 0)
+                    throw std::runtime_error("Unbalanced bitstream");
+                if (--excess == 0 && pos + 1 != length_)
+                    throw std::runtime_error("Bitstream holds several trees");
+                continue;
+            }
+            if (is_leaf(node)) {
+                // the root is a set and a leaf closes straight away
+                if (pos == 0 || pos + 1 == length_ || bit(pos + 1))
+                    throw std::runtime_error("Malformed bitstream leaf");
+                if (leaves == leaf_values_.size())
+                    throw std::runtime_error("Bitstream leaf without a value");
+                std::int32_t value = leaf_values_[leaves++];
+                if (value == 0 || -static_cast<std::int64_t>(value) > symbols)
+                    throw std::runtime_error("Bitstream symbol out of range");
+            }
+            node++;
+            excess++;
+        }
+        if (excess != 0)
+            throw std::runtime_error("Unbalanced bitstream");
+        if (leaves != leaf_values_.size())
+            throw std::runtime_error("Bitstream leaf count mismatch");
+    }
+
+    void push_bit(bool value) {
+        if (length_ % 64 == 0)
+            words_.push_back(0);
+        if (value)
+            words_.back() |= std::uint64_t(1) << (length_ % 64);
+        length_++;
+    }
+
+    void push_leaf_bit(bool value) {
+        if (nodes_ % 64 == 0)
+            leaf_words_.push_back(0);
+        if (value)
+            leaf_words_.back() |= std::uint64_t(1) << (nodes_ % 64);
+        nodes_++;
+    }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "slc_set.hpp"
+
+// a full word so toposet_node has no padding and every word handed to
+// JavaScript is defined
+enum class toposet_kind : std::uint32_t {
+    SET,
+    NUMBER,
+    SYMBOL,
+};
+
+// flat pre-order form of a toposet, one entry per set or leaf in document
+// order. A node's descendants are the size - 1 entries following it, so
+// skipping a subtree is a single add and no pointers are needed
+struct toposet_node {
+    toposet_kind kind;
+    // direct children of a set, 0 for leaves
+    std::uint32_t children;
+    // entries in the subtree including this one
+    std::uint32_t size;
+    // byte range of a leaf in the source text, the opening brace for sets
+    std::uint32_t offset;
+    std::uint32_t length;
+};
+
+// nodes are exposed to JavaScript as a Uint32Array with this many words per
+// entry, the kind first
+constexpr size_t toposet_node_words = 5;
+static_assert(sizeof(toposet_node) == 4 * toposet_node_words,
+              "toposet_node must stay a flat run of 32 bit words");
+
+struct toposet_flat {
+    const toposet_node *nodes;
+    size_t count;
+
+    const toposet_node &operator[](size_t index) const { return nodes[index]; }
+    const toposet_node *begin() const { return nodes; }
+    const toposet_node *end() const { return nodes + count; }
+
+    // index of the next sibling of index, or the end of its parent
+    size_t skip(size_t index) const { return index + nodes[index].size; }
+};
+
+// flattens an interned set into out, replacing its contents. Offsets refer
+// to the text SLC_store::serialize writes for root, so leaves can be sliced
+// from it without parsing
+inline void toposet_flatten(const SLC_store &store, SLC_id root,
+                            std::vector<toposet_node> &out) {
+    struct frame {
+        SLC_id id;
+        std::uint32_t next;
+        std::uint32_t index;
+    };
+    out.clear();
+    std::vector<frame> stk;
+    std::uint32_t pos = 0;
+    auto open = [&](SLC_id id) {
+        std::uint32_t count =
+            static_cast<std::uint32_t>(store.elements(id).size());
+        stk.push_back({id, 0, static_cast<std::uint32_t>(out.size())});
+        out.push_back({toposet_kind::SET, count, 0, pos, 1});
+        pos++;
+    };
+    open(root);
+    while (!stk.empty()) {
+        frame &top = stk.back();
+        SLC_range elems = store.elements(top.id);
+        if (top.next == elems.size()) {
+            out[top.index].size =
+                static_cast<std::uint32_t>(out.size() - top.index);
+            pos++;
+            stk.pop_back();
+            continue;
+        }
+        // ", " between elements
+        if (top.next != 0)
+            pos += 2;
+        const SLC_element &elem = elems.first[top.next++];
+        if (auto ref = std::get_if<SLC_ref>(&elem)) {
+            open(ref->id);
+            continue;
+        }
+        std::uint32_t length =
+            static_cast<std::uint32_t>(SLC_store::leaf_size(elem));
+        toposet_kind kind = std::holds_alternative<int>(elem)
+                                ? toposet_kind::NUMBER
+                                : toposet_kind::SYMBOL;
+        out.push_back({kind, 0, 1, pos, length});
+        pos += length;
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "toposet_flat.hpp"
+
+// nested box layout of a flat toposet for the canvas renderer in
+// topology_generator.js, one box per node in the same pre-order. Sizes follow
+// the page's old DOM boxes: a childless box is 8 by 8 and a set pads its
+// children by 2.5 on every side, with 5 between neighbours. Children fill
+// rows left to right, wrapping at about the square root of their total area
+// so every set stays roughly square. x and y are relative to the parent's
+// corner, so a set that moves leaves the boxes inside it unchanged and an
+// edit only changes the boxes it resizes or moves
+struct toposet_box {
+    float x;
+    float y;
+    float w;
+    float h;
+};
+
+// boxes are exposed to JavaScript as a Float32Array with this many floats
+// per entry
+constexpr size_t toposet_box_words = 4;
+static_assert(sizeof(toposet_box) == 4 * toposet_box_words,
+              "toposet_box must stay a flat run of 32 bit floats");
+
+constexpr float toposet_box_leaf = 8;
+constexpr float toposet_box_padding = 2.5f;
+constexpr float toposet_box_gap = 5;
+
+// lays out nodes into boxes, replacing its contents. The root is placed at
+// the origin. One linear pass in reverse pre-order, where every child is
+// done before its parent, sizes each set and places its children
+inline void toposet_layout(const std::vector<toposet_node> &nodes,
+                           std::vector<toposet_box> &boxes) {
+    boxes.assign(nodes.size(), {0, 0, toposet_box_leaf, toposet_box_leaf});
+    for (size_t i = nodes.size(); i-- > 0;) {
+        if (nodes[i].children == 0)
+            continue;
+        float area = 0, widest = 0;
+        size_t child = i + 1;
+        for (std::uint32_t k = 0; k < nodes[i].children; k++) {
+            const toposet_box &box = boxes[child];
+            area += (box.w + toposet_box_gap) * (box.h + toposet_box_gap);
+            widest = std::max(widest, box.w);
+            child += nodes[child].size;
+        }
+        // rows left to right from the content corner
+        float wrap = std::max(widest, std::sqrt(area));
+        float x = 0, y = 0, row = 0, width = 0;
+        child = i + 1;
+        for (std::uint32_t k = 0; k < nodes[i].children; k++) {
+            toposet_box &box = boxes[child];
+            if (x > 0 && x + box.w > wrap) {
+                y += row + toposet_box_gap;
+                x = row = 0;
+            }
+            box.x = toposet_box_padding + x;
+            box.y = toposet_box_padding + y;
+            width = std::max(width, x + box.w);
+            row = std::max(row, box.h);
+            x += box.w + toposet_box_gap;
+            child += nodes[child].size;
+        }
+        boxes[i].w = width + 2 * toposet_box_padding;
+        boxes[i].h = y + row + 2 * toposet_box_padding;
+    }
+}
+
+// what changed between two laid out views, so a renderer holding the old
+// arrays can rebuild the new ones from a small message. Nodes are matched by
+// their place in the text: those before start kept their kind and text
+// range, and those from end on equal the old ones from old_end on with their
+// offsets moved by shift, as the text before them grew or shrank. Nodes in
+// between are new. Matched nodes whose children, size, box or parent
+// changed, such as the sets around an edit, are listed in patches by their
+// new index. Against an empty view the whole new view is the changed range
+struct toposet_damage {
+    std::uint32_t start = 0;
+    std::uint32_t old_end = 0;
+    std::uint32_t end = 0;
+    std::int32_t shift = 0;
+    // ascending
+    std::vector<std::uint32_t> patches;
+    // parent of every old and new node, reused between calls
+    std::vector<std::uint32_t> old_parents;
+    std::vector<std::uint32_t> parents;
+};
+
+// parent index of every node, the root's is its own
+inline void toposet_parents(const std::vector<toposet_node> &nodes,
+                            std::vector<std::uint32_t> &parents) {
+    parents.resize(nodes.size());
+    std::vector<std::uint32_t> open;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        while (!open.empty() && open.back() + nodes[open.back()].size <= i)
+            open.pop_back();
+        parents[i] = open.empty() ? 0 : open.back();
+        open.push_back(static_cast<std::uint32_t>(i));
+    }
+}
+
+// compares the old and new views from both ends in linear time
+inline void toposet_diff(const std::vector<toposet_node> &old_nodes,
+                         const std::vector<toposet_box> &old_boxes,
+                         const std::vector<toposet_node> &nodes,
+                         const std::vector<toposet_box> &boxes,
+                         toposet_damage &damage) {
+    auto same_text = [&](size_t a, size_t b, std::int64_t shift) {
+        const toposet_node &p = old_nodes[a];
+        const toposet_node &q = nodes[b];
+        return p.kind == q.kind && p.length == q.length &&
+               p.offset + shift == q.offset;
+    };
+    auto same_shape = [&](size_t a, size_t b) {
+        const toposet_node &p = old_nodes[a];
+        const toposet_node &q = nodes[b];
+        const toposet_box &u = old_boxes[a];
+        const toposet_box &v = boxes[b];
+        return p.children == q.children && p.size == q.size && u.x == v.x &&
+               u.y == v.y && u.w == v.w && u.h == v.h;
+    };
+
+    size_t old_count = old_nodes.size();
+    size_t count = nodes.size();
+    size_t common = std::min(old_count, count);
+    size_t start = 0;
+    while (start < common && same_text(start, start, 0))
+        start++;
+    std::int64_t shift =
+        common == 0 ? 0
+                    : std::int64_t(nodes.back().offset) -
+                          std::int64_t(old_nodes.back().offset);
+    size_t same = 0;
+    while (same < common - start &&
+           same_text(old_count - 1 - same, count - 1 - same, shift))
+        same++;
+    damage.start = static_cast<std::uint32_t>(start);
+    damage.old_end = static_cast<std::uint32_t>(old_count - same);
+    damage.end = static_cast<std::uint32_t>(count - same);
+    damage.shift = static_cast<std::int32_t>(shift);
+
+    // the text before a node decides its parent, so only the nodes after
+    // the change can have moved to another set
+    toposet_parents(old_nodes, damage.old_parents);
+    toposet_parents(nodes, damage.parents);
+    damage.patches.clear();
+    for (size_t i = 0; i < start; i++) {
+        if (!same_shape(i, i))
+            damage.patches.push_back(static_cast<std::uint32_t>(i));
+    }
+    for (size_t b = damage.end; b < count; b++) {
+        size_t a = b - damage.end + damage.old_end;
+        std::uint32_t parent = damage.old_parents[a];
+        if (parent >= damage.old_end)
+            parent += damage.end - damage.old_end;
+        else if (parent >= start)
+            parent = static_cast<std::uint32_t>(b);
+        if (!same_shape(a, b) || parent != damage.parents[b])
+            damage.patches.push_back(static_cast<std::uint32_t>(b));
+    }
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "brace_scan.hpp"
+#include "huffman_encodings.hpp"
+#include "slc_set.hpp"
+#include "toposet_bp.hpp"
+#include "toposet_flat.hpp"
+#include "toposet_stats.hpp"
+
+// parser for toposet text and bitstreams, shared by toposet_reducer and the
+// benchmarks
+
+struct toposet_parser {
+    std::string_view str_;
+    SLC_store store_;
+    toposet_parser(std::string_view str) : str_(str) {}
+    // filled in only when built with TOPOSET_STATS
+    toposet_stats stats_;
+
+    // buffers reused by parse_flat, str_ can be swapped between calls
+    std::vector<toposet_node> flat_;
+    std::vector<std::uint32_t> open_;
+
+    static bool is_separator(char ch) { return brace_is_separator(ch); }
+
+    // exact number of entries parse_flat will emit, so the output buffer is
+    // sized once up front
+    size_t count_nodes() const {
+        brace_counts counts = count_braces(str_);
+        return counts.open + counts.leaves;
+    }
+
+    // parses str_ into a flat pre-order buffer without building any sets.
+    // Leaves (De Bruijn numbers and symbols such as λ) are kept as byte
+    // ranges into str_, which must outlive the result
+    toposet_flat parse_flat() {
+        toposet_timer timer(stats_.toposet_ns);
+        toposet_flat flat = parse_flat_text();
+        if constexpr (toposet_stats_enabled)
+            stats_.nodes_visited += flat.count;
+        return flat;
+    }
+
+    // parse_flat without the stats
+    toposet_flat parse_flat_text() {
+        flat_.clear();
+        open_.clear();
+        brace_counts counts = count_braces(str_);
+        flat_.reserve(counts.open + counts.leaves);
+        // pure topologies only need the brace positions
+        if (counts.leaves == 0)
+            return parse_flat_braces();
+
+        auto add_child = [this]() {
+            if (!open_.empty())
+                flat_[open_.back()].children++;
+        };
+
+        size_t len = str_.size();
+        for (size_t i = 0; i < len; i++) {
+            char ch = str_[i];
+            if (ch == '{') {
+                add_child();
+                open_.push_back(static_cast<std::uint32_t>(flat_.size()));
+                flat_.push_back({toposet_kind::SET, 0, 1,
+                                 static_cast<std::uint32_t>(i), 1});
+            } else if (ch == '}') {
+                if (open_.empty())
+                    throw std::runtime_error("Unexpected '}'");
+                toposet_node &node = flat_[open_.back()];
+                node.size =
+                    static_cast<std::uint32_t>(flat_.size() - open_.back());
+                open_.pop_back();
+                if (open_.empty())
+                    return {flat_.data(), flat_.size()};
+            } else if (!is_separator(ch)) {
+                if (open_.empty())
+                    throw std::runtime_error("Leaf outside of a set");
+                size_t start = i;
+                bool number = true;
+                while (i < len && !is_separator(str_[i])) {
+                    number = number && str_[i] >= '0' && str_[i] <= '9';
+                    i++;
+                }
+                add_child();
+                flat_.push_back(
+                    {number ? toposet_kind::NUMBER : toposet_kind::SYMBOL, 0,
+                     1, static_cast<std::uint32_t>(start),
+                     static_cast<std::uint32_t>(i - start)});
+                i--;
+            }
+        }
+        throw std::runtime_error("Could not parse!");
+    }
+
+    toposet_flat parse_flat_braces() {
+        bool done = false;
+        for_each_brace(str_, [&](size_t pos, bool open) {
+            if (done)
+                return;
+            if (open) {
+                if (!open_.empty())
+                    flat_[open_.back()].children++;
+                open_.push_back(static_cast<std::uint32_t>(flat_.size()));
+                flat_.push_back({toposet_kind::SET, 0, 1,
+                                 static_cast<std::uint32_t>(pos), 1});
+                return;
+            }
+            if (open_.empty())
+                throw std::runtime_error("Unexpected '}'");
+            flat_[open_.back()].size =
+                static_cast<std::uint32_t>(flat_.size() - open_.back());
+            open_.pop_back();
+            done = open_.empty();
+        });
+        if (!done)
+            throw std::runtime_error("Could not parse!");
+        return {flat_.data(), flat_.size()};
+    }
+
+    // sets new to the store since it held sets entries, plus the depth of
+    // the parsed root
+    void record_sets(size_t sets, SLC_id root) {
+        if constexpr (toposet_stats_enabled) {
+            stats_.sets_allocated += store_.size() - sets;
+            stats_.max_depth = std::max<std::uint64_t>(stats_.max_depth,
+                                                       store_.depth(root));
+        }
+    }
+
+    SLC_set parse_toposet() {
+        toposet_timer timer(stats_.toposet_ns);
+        size_t sets = store_.size();
+        std::stack<std::vector<SLC_element>> stk;
+        bool done = false;
+        SLC_id root = 0;
+
+        for_each_brace(str_, [&](size_t, bool open) {
+            if (done)
+                return;
+            if (open) {
+                stk.emplace();
+                return;
+            }
+            if (stk.empty())
+                throw std::runtime_error("Unexpected '}'");
+
+            SLC_id completed_set = store_.intern(stk.top());
+            stk.pop();
+            if constexpr (toposet_stats_enabled)
+                stats_.nodes_visited++;
+
+            if (!stk.empty()) {
+                stk.top().push_back(SLC_ref{completed_set});
+            } else {
+                root = completed_set;
+                done = true;
+            }
+        });
+        if (!done)
+            throw std::runtime_error("Could not parse!");
+        record_sets(sets, root);
+        return {&store_, root};
+    }
+
+    // decodes a bitstream into the store, symbol leaves refer to the
+    // strings of bp so it must outlive the result
+    SLC_set parse_bp(const toposet_bp &bp) {
+        toposet_timer timer(stats_.toposet_ns);
+        size_t sets = store_.size();
+        if constexpr (toposet_stats_enabled)
+            stats_.nodes_visited += bp.size();
+        std::vector<std::vector<SLC_element>> stk;
+        size_t depth = 0;
+        size_t node = 0;
+        for (size_t pos = 0; pos < bp.length_; pos++) {
+            if (bp.bit(pos)) {
+                if (bp.is_leaf(node)) {
+                    std::int32_t value = bp.leaf_value(node);
+                    if (value > 0)
+                        stk[depth - 1].push_back(value);
+                    else
+                        stk[depth - 1].push_back(bp.leaf_symbol(value));
+                    node++;
+                    pos++;
+                    continue;
+                }
+                if (depth == stk.size())
+                    stk.emplace_back();
+                stk[depth++].clear();
+                node++;
+                continue;
+            }
+            if (depth == 0)
+                throw std::runtime_error("Unbalanced bitstream");
+            SLC_id completed_set = store_.intern(stk[--depth]);
+            if (depth == 0) {
+                record_sets(sets, completed_set);
+                return {&store_, completed_set};
+            }
+            stk[depth - 1].push_back(SLC_ref{completed_set});
+        }
+        throw std::runtime_error("Could not parse!");
+    }
+
+    // the tokenization process of a topology involves mapping the D-ary
+    // huffman encodings to their string or int counterparts. Leaf sets are
+    // the sets of depth 2 or 3 and carry a code (digit, index):
+    //
+    // {{}}                   -> λ        (0, 0)
+    // {{{}, {}}, {}, ..}     -> n        (1, n - 1)
+    // {{{}, {}, {}}, {}, ..} -> + - * /  (2, 0..3)
+    //
+    // the digit is read from the arity of the selector, the one element not
+    // equal to {}, and the index is the number of {} next to it
+    SLC_set tokenize(SLC_set topology) {
+        return tokenize(topology, encoding_table());
+    }
+
+    static bool is_leaf(std::uint32_t depth) {
+        return depth == 2 || depth == 3;
+    }
+
+    SLC_set tokenize(SLC_set topology, const huffman_table &table) {
+        if (is_leaf(store_.depth(topology.id)))
+            throw std::runtime_error("Topology is a single leaf set");
+        // post-order walk of the sets reachable from the root, each one
+        // tokenized once and its token kept by id. Leaves are decoded when a
+        // parent first refers to them, the sets inside a leaf are never
+        // visited
+        size_t count = store_.size();
+        std::vector<SLC_element> tokens(count);
+        std::vector<bool> done(count);
+        struct frame {
+            SLC_id id;
+            bool expanded;
+        };
+        std::vector<frame> stk;
+        stk.push_back({topology.id, false});
+        std::vector<SLC_element> elems;
+        while (!stk.empty()) {
+            frame f = stk.back();
+            if (done[f.id]) {
+                stk.pop_back();
+                continue;
+            }
+            if (!f.expanded) {
+                stk.back().expanded = true;
+                for (const SLC_element &elem : store_.elements(f.id)) {
+                    SLC_id child = set_of(elem);
+                    if (!done[child] && !is_leaf(store_.depth(child)))
+                        stk.push_back({child, false});
+                }
+                continue;
+            }
+            stk.pop_back();
+            for (const SLC_element &elem : store_.elements(f.id)) {
+                SLC_id child = set_of(elem);
+                if (!done[child]) {
+                    tokens[child] = decode_leaf(child, table);
+                    done[child] = true;
+                }
+                elems.push_back(tokens[child]);
+            }
+            tokens[f.id] = SLC_ref{store_.intern(elems)};
+            done[f.id] = true;
+            elems.clear();
+        }
+        return {&store_, std::get<SLC_ref>(tokens[topology.id]).id};
+    }
+
+    // id of an element of a pure topology, which holds nothing but sets
+    static SLC_id set_of(const SLC_element &elem) {
+        if (auto ref = std::get_if<SLC_ref>(&elem))
+            return ref->id;
+        throw std::runtime_error("Topology already holds tokens");
+    }
+
+    SLC_element decode_leaf(SLC_id id, const huffman_table &table) const {
+        size_t arity = 0;
+        size_t extras = 0;
+        bool selector = false;
+        for (const SLC_element &elem : store_.elements(id)) {
+            SLC_id child = set_of(elem);
+            size_t size = store_.elements(child).size();
+            if (size == 0) {
+                extras++;
+            } else if (!selector) {
+                selector = true;
+                arity = size;
+            } else {
+                throw std::runtime_error("Unknown leaf set");
+            }
+        }
+        // {{}} has no selector, its lone {} is the selector of arity 0
+        if (!selector)
+            extras--;
+        if (arity == 1)
+            throw std::runtime_error("Unknown leaf set");
+        size_t digit = arity == 0 ? 0 : arity - 1;
+
+        huffman_table::symbol sym = table.decode(digit, extras);
+        if (auto text = std::get_if<std::string_view>(&sym))
+            return *text;
+        if (auto number = std::get_if<int>(&sym))
+            return *number;
+        throw std::runtime_error("Unknown leaf set");
+    }
+};
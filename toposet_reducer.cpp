@@ -1,66 +1,154 @@
-#include <iostream>
-#include <memory>
-#include <stack>
+#include <algorithm>
 #include <string>
-#include <variant>
 #include <vector>
 
-#include "huffman_encodings.hpp"
-#include "slc_set.hpp"
+#include "brace_scan.hpp"
+#include "toposet_bp.hpp"
+#include "toposet_flat.hpp"
+#include "toposet_parser.hpp"
 
-struct toposet_parser {
-    std::string_view str_;
-    toposet_parser(std::string_view str) : str_(str) {}
+// TOPOSET_CORE leaves only the wasm exports, as in ulc2toposet.cpp
+#ifndef TOPOSET_CORE
+#include <iostream>
+#endif
 
-    SLC_set parse_toposet() {
-        std::stack<SLC_set> stk;
-        SLC_set base;
+#ifdef __EMSCRIPTEN__
+#include <emscripten/bind.h>
+#elif !defined(TOPOSET_CORE)
+#include "line_driver.hpp"
+#include "mapped_file.hpp"
 
-        for (char ch : str_) {
-            if (ch == '{') {
-                SLC_set next;
-                stk.push(next);
-            } else if (ch == '}') {
-                if (stk.empty())
-                    throw std::runtime_error("Unexpected '}'");
+// interned sets kept between lines before the store is recycled
+constexpr size_t toposet_line_store_limit = 1 << 20;
 
-                SLC_set completed_set = std::move(stk.top());
-                stk.pop();
+// reduces one toposet per line to its De Bruijn form
+struct toposet_line_worker {
+    toposet_parser parser_{""};
 
-                if (!stk.empty()) {
-                    stk.top().elements.insert(
-                        std::make_shared<SLC_set>(std::move(completed_set)));
-                } else {
-                    return completed_set;
-                }
-            }
-        }
-        throw std::runtime_error("Could not parse!");
-        return base;
+    void operator()(std::string_view line, std::string &out) {
+        if (parser_.store_.size() > toposet_line_store_limit)
+            parser_.store_.clear();
+        parser_.str_ = line;
+        parser_.tokenize(parser_.parse_toposet()).serialize(out);
     }
-
-    // the tokenization process of a topology involves mapping the D-ary
-    // huffman encodings to their string or int counterparts
-    SLC_set tokenize() {}
 };
 
-int main() {
-    std::vector<huffman_node> ops;
-    ops.emplace_back("+");
-    ops.emplace_back("-");
-    ops.emplace_back("*");
-    ops.emplace_back("/");
+// toposet_reducer --lines [-j threads] input [output]
+//
+// reduces every line of the mapped input, one result per line, to stdout
+// unless output is given. -j 0 reduces on every hardware thread
+int toposet_cli(int argc, char **argv) {
+    unsigned threads = 1;
+    bool usage = false;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc)
+            threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (!arg.empty() && arg[0] != '-')
+            paths.push_back(arg);
+        else
+            usage = true;
+    }
+    if (usage || paths.empty() || paths.size() > 2) {
+        std::cerr << "usage: toposet_reducer --lines [-j threads] input "
+                     "[output]"
+                  << std::endl;
+        return 2;
+    }
+    mapped_file input(paths[0]);
+    int fd = STDOUT_FILENO;
+    if (paths.size() == 2) {
+        fd = open(paths[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Could not open " + paths[1]);
+    }
+    size_t failed = convert_lines(input.view(), fd, threads,
+                                  [] { return toposet_line_worker(); });
+    if (fd != STDOUT_FILENO)
+        close(fd);
+    return failed ? 1 : 0;
+}
 
-    std::vector<huffman_node> root_children;
-    root_children.emplace_back("λ");
-    root_children.emplace_back(natural_numbers());
-    root_children.emplace_back(std::move(ops));
+// toposet_reducer <file> parses a mapped toposet in place
+int toposet_file(const char *path) {
+    mapped_file file(path);
+    // bitstreams from ulc2slc_bp / ulc2dbj_bp are decoded back to text
+    if (file.view().substr(0, 4) == "TPBP") {
+        toposet_bp bp;
+        bp.from_bytes(file.view());
+        toposet_parser parser("");
+        std::cout << parser.parse_bp(bp).to_string() << std::endl;
+        if constexpr (toposet_stats_enabled)
+            parser.stats_.print(std::cerr);
+        return 0;
+    }
+    toposet_parser parser(file.view());
+    toposet_flat flat = parser.parse_flat();
+    std::cout << flat.count << " nodes, depth ";
+    size_t depth = 0;
+    for_each_depth(file.view(), [&depth](size_t, size_t node_depth) {
+        depth = std::max(depth, node_depth);
+    });
+    std::cout << depth << std::endl;
+    if constexpr (toposet_stats_enabled)
+        parser.stats_.print(std::cerr);
+    return 0;
+}
+#endif
 
-    huffman_node huffman_tree(std::move(root_children));
+#ifndef TOPOSET_CORE
+int main(int argc, char **argv) {
+#ifndef __EMSCRIPTEN__
+    if (argc > 1) {
+        try {
+            if (std::string(argv[1]) == "--lines")
+                return toposet_cli(argc, argv);
+            return toposet_file(argv[1]);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+#endif
 
     toposet_parser parser(
         "{{{}}, {{{}}, {{{{{{{}, {}}, {}}}, {{{}}, {{{}}, {{{}}, {{{{{}, {}}}, "
         "{{{{{}, {{}, {}}, {}}}, {{}, {{}, {}}}}}}, {{{{}, {}}, {}}}}}}}}}, "
         "{{{}, {}}}}}}");
-    std::cout << parser.parse_toposet().to_string();
+    SLC_set topology = parser.parse_toposet();
+    std::cout << topology.to_string() << std::endl;
+    std::cout << parser.tokenize(topology).to_string() << std::endl;
+    if constexpr (toposet_stats_enabled)
+        parser.stats_.print(std::cerr);
+}
+#endif
+
+#ifdef __EMSCRIPTEN__
+// text of the toposet in str, as parsed and reduced to its De Bruijn form
+std::string toposet_parse(std::string str) {
+    toposet_parser parser(str);
+    return parser.parse_toposet().to_string();
+}
+
+std::string toposet_reduce(std::string str) {
+    toposet_parser parser(str);
+    return parser.tokenize(parser.parse_toposet()).to_string();
+}
+
+// text of a bitstream from ulc2dbj_bp or ulc2slc_bp, passed in as a
+// Uint8Array
+std::string toposet_parse_bp(std::string bytes) {
+    toposet_bp bp;
+    bp.from_bytes(bytes);
+    toposet_parser parser("");
+    return parser.parse_bp(bp).to_string();
+}
+
+// emscripten bindings
+EMSCRIPTEN_BINDINGS(toposet_reducer) {
+    emscripten::function("parse", &toposet_parse);
+    emscripten::function("parse_bp", &toposet_parse_bp);
+    emscripten::function("reduce", &toposet_reduce);
 }
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+// optional instrumentation of ULC_converter and toposet_parser. Building with
+// -DTOPOSET_STATS fills the counters in, otherwise toposet_stats_enabled is
+// false and every update is an if constexpr branch that compiles to nothing
+#ifdef TOPOSET_STATS
+constexpr bool toposet_stats_enabled = true;
+#else
+constexpr bool toposet_stats_enabled = false;
+#endif
+
+struct toposet_stats {
+    // AST nodes converted, or sets and leaves read by the toposet parser
+    std::uint64_t nodes_visited = 0;
+    // sets that were new to their store
+    std::uint64_t sets_allocated = 0;
+    // number and λ sets built by make_number and make_lambda
+    std::uint64_t leaf_sets = 0;
+    std::uint64_t bytes_emitted = 0;
+    std::uint64_t max_depth = 0;
+    // ULC_cache lookups of whole terms and closed subterms
+    std::uint64_t cache_hits = 0;
+    std::uint64_t cache_misses = 0;
+    // wall time per phase, in nanoseconds
+    std::uint64_t lex_ns = 0;
+    std::uint64_t parse_ns = 0;
+    std::uint64_t convert_ns = 0;
+    std::uint64_t serialize_ns = 0;
+    std::uint64_t toposet_ns = 0;
+
+    void add(const toposet_stats &other) {
+        nodes_visited += other.nodes_visited;
+        sets_allocated += other.sets_allocated;
+        leaf_sets += other.leaf_sets;
+        bytes_emitted += other.bytes_emitted;
+        max_depth = std::max(max_depth, other.max_depth);
+        cache_hits += other.cache_hits;
+        cache_misses += other.cache_misses;
+        lex_ns += other.lex_ns;
+        parse_ns += other.parse_ns;
+        convert_ns += other.convert_ns;
+        serialize_ns += other.serialize_ns;
+        toposet_ns += other.toposet_ns;
+    }
+
+    // one name=value line, Stream is anything with operator<< such as
+    // std::ostream, which keeps iostream out of this header
+    template <typename Stream> void print(Stream &out) const {
+        out << "nodes_visited=" << nodes_visited
+            << " sets_allocated=" << sets_allocated
+            << " leaf_sets=" << leaf_sets << " bytes_emitted=" << bytes_emitted
+            << " max_depth=" << max_depth << " cache_hits=" << cache_hits
+            << " cache_misses=" << cache_misses << " lex_ns=" << lex_ns
+            << " parse_ns=" << parse_ns << " convert_ns=" << convert_ns
+            << " serialize_ns=" << serialize_ns << " toposet_ns=" << toposet_ns
+            << '\n';
+    }
+};
+
+// adds the wall time of its scope to one of the phase counters
+struct toposet_timer {
+    std::uint64_t &slot_;
+    std::chrono::steady_clock::time_point start_;
+
+    explicit toposet_timer(std::uint64_t &slot) : slot_(slot) {
+        if constexpr (toposet_stats_enabled)
+            start_ = std::chrono::steady_clock::now();
+    }
+    ~toposet_timer() {
+        if constexpr (toposet_stats_enabled)
+            slot_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start_)
+                         .count();
+    }
+    toposet_timer(const toposet_timer &) = delete;
+    toposet_timer &operator=(const toposet_timer &) = delete;
+};
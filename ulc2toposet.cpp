@@ -24,462 +24,801 @@
 // index lambda calculus.
 
 #include <algorithm>
-#include <iostream>
-#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
 #include <optional>
-#include <set>
-#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "slc_set.hpp"
+#include "toposet_bp.hpp"
+#include "toposet_flat.hpp"
+#include "toposet_layout.hpp"
+#include "toposet_stats.hpp"
+#include "ulc_cache.hpp"
+#include "ulc_converter.hpp"
+#include "ulc_reducer.hpp"
+
+// TOPOSET_CORE builds only what the wasm modules export: the demo main, the
+// ostream helpers and the command line modes go, and with them iostream
+#ifndef TOPOSET_CORE
+#include <iostream>
+#endif
+#include "ulc_static.hpp"
+#ifdef __EMSCRIPTEN__
 #include <emscripten/bind.h>
-
-enum class ULC_token_type {
-    LAMBDA,
-    VARIABLE,
-    DOT,
-    O_PAREN,
-    C_PAREN,
-    EOF_TOK,
+#include <emscripten/em_js.h>
+#elif !defined(TOPOSET_CORE)
+#include <fstream>
+
+#include "line_driver.hpp"
+#include "mapped_file.hpp"
+#endif
+
+// totals over every conversion since the last reset, all zero unless built
+// with TOPOSET_STATS
+static toposet_stats stats_totals;
+static std::mutex stats_mutex;
+
+// adds a converter's stats to the totals when it goes out of scope and starts
+// them over, so long lived converters such as a session's are not counted
+// twice
+struct ULC_stats_scope {
+    toposet_stats &stats_;
+    ~ULC_stats_scope() {
+        if constexpr (toposet_stats_enabled) {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats_totals.add(stats_);
+            stats_ = {};
+        }
+    }
 };
 
-struct ULC_token {
-    ULC_token() : type(ULC_token_type::EOF_TOK) {}
-    ULC_token(ULC_token_type t) : type(t) {}
-    ULC_token(ULC_token_type t, std::string_view s) : type(t), text(s) {}
+toposet_stats ulc_stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return stats_totals;
+}
 
-    ULC_token_type type;
-    std::string_view text;
-};
+void ulc_stats_reset() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats_totals = {};
+}
 
-struct ULC_lexer {
-    std::string_view text_;
-    int pos_;
-    ULC_lexer(std::string_view text) : text_(text), pos_(0) {}
-
-    ULC_token next_token() {
-        // EOF and whitespace handling
-        if (pos_ >= text_.length())
-            return ULC_token(ULC_token_type::EOF_TOK);
-        char ch = text_[pos_];
-        while (std::isspace(ch)) {
-            pos_++;
-            if (pos_ >= text_.length())
-                return ULC_token(ULC_token_type::EOF_TOK);
-            ch = text_[pos_];
-        }
+#ifndef TOPOSET_CORE
+void display(std::string_view str) {
+    std::cout << "λ: " << str << std::endl;
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    auto write = [](const char *data, size_t len) {
+        std::cout.write(data, len);
+    };
+    ULC_conversion result = converter.convert_both();
+    std::cout << "De Bruijn: ";
+    converter.serialize(result.dbj, write);
+    std::cout << std::endl << "SLC: ";
+    converter.serialize(result.slc, write);
+    std::cout << std::endl << std::endl;
+}
 
-        int original_pos = pos_;
-        if (ch == '.') {
-            pos_++;
-            return ULC_token(ULC_token_type::DOT, ".");
-        } else if (ch == '\\') {
-            pos_++;
-            return ULC_token(ULC_token_type::LAMBDA, "\\");
-        } else if (ch == '(') {
-            pos_++;
-            return ULC_token(ULC_token_type::O_PAREN, "(");
-        } else if (ch == ')') {
-            pos_++;
-            return ULC_token(ULC_token_type::C_PAREN, ")");
-        } else if (std::isalnum(ch)) {
-            while (std::isalnum(ch)) {
-                pos_++;
-                if (pos_ >= text_.length())
-                    break;
-                ch = text_[pos_];
-            }
-            return ULC_token(ULC_token_type::VARIABLE,
-                             text_.substr(original_pos, pos_ - original_pos));
-        } else {
-            throw std::runtime_error("Invalid token");
+#ifndef __EMSCRIPTEN__
+int ulc_cli(int argc, char **argv);
+#endif
+
+int main(int argc, char **argv) {
+#ifndef __EMSCRIPTEN__
+    if (argc > 1) {
+        try {
+            return ulc_cli(argc, argv);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
         }
     }
-};
+#endif
+    std::cout << "Identity:" << std::endl;
+    display("\\x.x");
 
-enum class ULC_AST_type {
-    APPLICATION,
-    DEFINITION,
-    ATOMIC,
-    GROUP,
-};
+    std::cout << "K-Combinator:" << std::endl;
+    display("\\x.\\y.x");
 
-struct ULC_AST_node {
-    ULC_AST_type type;
-    std::unique_ptr<struct ULC_AST_node> right;
-    std::unique_ptr<struct ULC_AST_node> left;
-    ULC_token value;
+    std::cout << "S-Combinator:" << std::endl;
+    display("\\x.\\y.\\z.((x z)(y z))");
 
-    ULC_AST_node(ULC_token v) : type(ULC_AST_type::ATOMIC), value(v) {}
-    ULC_AST_node() {}
-};
+    std::cout << "Fixed-Point Combinator:" << std::endl;
+    display("(\\f.(\\x.f (x x)) (\\x.f (x x)))");
 
-/*
- * Parse Grammar:
- *
- * P := A | P (A | B)
- * B := 'λ' V '.' E
- * E := A | B | P
- * A := '(' E ')' | V
- *
- * Important to note this actual structure is modified in implementation to get
- * around right associativity constraints.
- */
-
-struct ULC_parser {
-    ULC_lexer lexer_;
-    ULC_parser(ULC_lexer lexer) : lexer_(lexer), token_id_(0) {
-        tokens_.push_back(lexer_.next_token());
-    }
-    std::vector<ULC_token> tokens_;
-    int token_id_;
+    std::cout << "0:" << std::endl;
+    display("(\\f.(\\x.x))");
 
-    ULC_token peek() { return tokens_[token_id_]; }
+    std::cout << "Succ:" << std::endl;
+    display("(\\n.\\f.\\x.f(n f x))");
 
-    // grab next token from lexer if we haven't already
-    ULC_token next_token() {
-        token_id_++;
-        if (token_id_ >= tokens_.size()) {
-            tokens_.push_back(lexer_.next_token());
-        }
-        return tokens_[token_id_];
-    }
+    std::cout << "+:" << std::endl;
+    display("\\m.\\k.m (\\n.\\f.\\x.f(n f x)) k");
 
-    // true if token of type can be consumed
-    bool consume_type(ULC_token_type type) {
-        if (peek().type == type) {
-            next_token();
-            return true;
-        }
-        return false;
-    }
+    if constexpr (toposet_stats_enabled)
+        ulc_stats().print(std::cerr);
+}
+#endif
 
-    // ptr to ast node of consumed variable
-    std::unique_ptr<ULC_AST_node> consume_variable() {
-        auto node = std::make_unique<ULC_AST_node>();
-        if (peek().type == ULC_token_type::VARIABLE) {
-            node->type = ULC_AST_type::ATOMIC;
-            node->value = peek();
-            next_token();
-            return node;
-        }
-        return nullptr;
-    }
+// earlier ulc2dbj / ulc2slc results by name free term, see ulc_cache.hpp
+static ULC_cache dbj_cache;
+static ULC_cache slc_cache;
+static std::mutex cache_mutex;
 
-    // wrapper for parse
-    std::unique_ptr<ULC_AST_node> parse() { return parse_expression(); }
-
-    // parses a function definition
-    std::unique_ptr<ULC_AST_node> parse_abstraction() {
-        int original_id = token_id_;
-        auto node = std::make_unique<ULC_AST_node>();
-
-        if (consume_type(ULC_token_type::LAMBDA)) {
-            node->type = ULC_AST_type::DEFINITION;
-            auto var = consume_variable();
-            if (var != nullptr) {
-                node->right = std::move(var);
-                if (consume_type(ULC_token_type::DOT)) {
-                    auto expr = parse_expression();
-                    if (expr != nullptr) {
-                        node->left = std::move(expr);
-                        return node;
-                    }
-                }
-            }
-        }
+std::string ulc2dbj(std::string str) {
+    // fixed combinators are converted once, see ulc_static.hpp
+    if (const ULC_combinator *fixed = ULC_static_lookup(str))
+        return std::string(fixed->dbj);
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return converter.convert_cached(dbj_cache, false);
+}
 
-        token_id_ = original_id;
-        return nullptr;
-    }
+std::string ulc2slc(std::string str) {
+    // fixed combinators are converted once, see ulc_static.hpp
+    if (const ULC_combinator *fixed = ULC_static_lookup(str))
+        return std::string(fixed->slc);
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return converter.convert_cached(slc_cache, true);
+}
 
-    // parses an expression by trying to parse and abstraction then trying to
-    // parse applications
-    std::unique_ptr<ULC_AST_node> parse_expression() {
-        // try to parse an abstraction
-        if (peek().type == ULC_token_type::LAMBDA) {
-            auto abs = parse_abstraction();
-            return abs;
-        }
+// bytes each of the two caches may hold, 0 turns caching off
+void ulc_cache_limit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    dbj_cache.set_limit(bytes);
+    slc_cache.set_limit(bytes);
+}
 
-        auto head = parse_atomic();
-        if (!head) {
-            return nullptr;
-        }
+void ulc_cache_clear() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    dbj_cache.clear();
+    slc_cache.clear();
+}
 
-        while (true) {
-            // check for expression start
-            if (peek().type == ULC_token_type::VARIABLE ||
-                peek().type == ULC_token_type::O_PAREN) {
-                auto next_arg = parse_atomic();
-                if (!next_arg)
-                    break;
-                auto app = std::make_unique<ULC_AST_node>();
-                app->type = ULC_AST_type::APPLICATION;
-                // rearrange trees for right associativity
-                app->left = std::move(head);
-                app->right = std::move(next_arg);
-                head = std::move(app);
-            } else {
-                break;
-            }
-        }
-        return head;
-    }
+// De Bruijn then SLC text from one parse and one conversion pass
+std::vector<std::string> ulc2both(std::string str) {
+    if (const ULC_combinator *fixed = ULC_static_lookup(str))
+        return {std::string(fixed->dbj), std::string(fixed->slc)};
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    ULC_conversion result = converter.convert_both();
+    std::vector<std::string> out(2);
+    converter.serialize(result.dbj, out[0]);
+    converter.serialize(result.slc, out[1]);
+    return out;
+}
 
-    // parse an atomic as either (e) or v
-    std::unique_ptr<ULC_AST_node> parse_atomic() {
-        // try consuming a parenthesized expression
-        if (consume_type(ULC_token_type::O_PAREN)) {
-            auto node = std::make_unique<ULC_AST_node>();
-            node->type = ULC_AST_type::GROUP;
-            node->right = parse_expression();
-            if (!consume_type(ULC_token_type::C_PAREN)) {
-                throw std::runtime_error("Unbalanced parens!");
-            }
-            return node;
+// normal form of str by call by need reduction within the default limits,
+// see ulc_reducer.hpp
+ULC_AST ulc_reduce(std::string_view str) {
+    ULC_converter converter(str);
+    ULC_reducer reducer;
+    reducer.reduce(converter.ast_);
+    return std::move(reducer.out_);
+}
+
+// lambda text of the normal form of str
+std::string ulc_normalize(std::string str) {
+    return ULC_to_string(ulc_reduce(str));
+}
+
+// topologies of the normal form of str rather than of str itself
+std::string ulc2dbj_normal(std::string str) {
+    ULC_converter converter(ulc_reduce(str));
+    ULC_stats_scope record{converter.stats_};
+    std::string out;
+    converter.serialize(converter.convert_dbj(), out);
+    return out;
+}
+
+std::string ulc2slc_normal(std::string str) {
+    ULC_converter converter(ulc_reduce(str));
+    ULC_stats_scope record{converter.stats_};
+    std::string out;
+    converter.serialize(converter.convert(), out);
+    return out;
+}
+
+// bytes the streaming functions buffer before handing them on
+constexpr size_t ULC_stream_chunk = 1 << 16;
+
+// collects sink(const char *, size_t) writes and passes them to
+// flush(const char *, size_t) in chunks of a fixed size, so output of any
+// length is written with one bounded buffer
+template <typename Flush> struct ULC_chunked_sink {
+    Flush flush_;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+
+    ULC_chunked_sink(Flush flush, size_t chunk = ULC_stream_chunk)
+        : flush_(std::move(flush)), buffer_(chunk) {}
+
+    void operator()(const char *data, size_t len) {
+        while (len) {
+            size_t n = std::min(len, buffer_.size() - used_);
+            std::memcpy(buffer_.data() + used_, data, n);
+            used_ += n;
+            data += n;
+            len -= n;
+            if (used_ == buffer_.size())
+                finish();
         }
+    }
 
-        // otherwise consume a variable
-        auto var = consume_variable();
-        return var;
+    // flushes whatever is buffered
+    void finish() {
+        if (used_)
+            flush_(buffer_.data(), used_);
+        used_ = 0;
     }
 };
 
-// driver for converting ULC to SLC sets
-struct ULC_converter {
-    std::unique_ptr<ULC_AST_node> root_;
+#ifndef TOPOSET_CORE
+// writes the text of str to out in ULC_stream_chunk sized pieces without
+// building any sets
+void ulc2dbj_stream(std::string_view str, std::ostream &out) {
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    ULC_chunked_sink sink([&out](const char *data, size_t len) {
+        out.write(data, len);
+    });
+    converter.stream_dbj(sink);
+    sink.finish();
+}
 
-    ULC_converter(std::string_view text) {
-        ULC_lexer lexer(text);
-        ULC_parser parser(lexer);
-        root_ = parser.parse();
-    }
-    ULC_converter(std::unique_ptr<ULC_AST_node> root) {
-        root_ = std::move(root);
-    }
+void ulc2slc_stream(std::string_view str, std::ostream &out) {
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    ULC_chunked_sink sink([&out](const char *data, size_t len) {
+        out.write(data, len);
+    });
+    converter.stream(sink);
+    sink.finish();
+}
+#endif
 
-    SLC_set convert() {
-        std::vector<std::string_view> captured;
-        return convert_subset(root_.get(), 0, captured);
-    }
+// output sizes for capacity planning, parsing only
+ULC_shape ulc2dbj_shape(std::string str) {
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    return converter.measure_dbj();
+}
 
-    SLC_set convert_dbj() {
-        std::vector<std::string_view> captured;
-        return convert_subset_dbj(root_.get(), 0, captured);
-    }
+ULC_shape ulc2slc_shape(std::string str) {
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    return converter.measure();
+}
 
-    SLC_set convert_subset_dbj(const ULC_AST_node *node, int lambda_depth,
-                               std::vector<std::string_view> captured) {
-        SLC_set ret_set;
-        if (!node)
-            return ret_set;
-        switch (node->type) {
-        case ULC_AST_type::DEFINITION: {
-            ret_set.elements.insert("λ");
-            captured.insert(captured.begin(), node->right.get()->value.text);
-            if (node->left.get()->type == ULC_AST_type::ATOMIC) {
-                // ret_set.elements.insert(node->left.get()->value.text);
-                std::string_view var_name = node->left.get()->value.text;
-                auto it = std::find(captured.begin(), captured.end(), var_name);
-                if (it == captured.end())
-                    throw std::runtime_error("Unknown variable");
-                int position = std::distance(captured.begin(), it) + 1;
-                ret_set.elements.insert(position);
-            } else {
-                auto sub_set = convert_subset_dbj(node->left.get(),
-                                                  lambda_depth + 1, captured);
-                ret_set.elements.insert(
-                    std::make_shared<SLC_set>(std::move(sub_set)));
-            }
-            captured.erase(captured.begin());
-        }
-            return ret_set;
-            break;
-        case ULC_AST_type::APPLICATION: {
-            SLC_set promote_set;
-            if (node->left.get()->type == ULC_AST_type::ATOMIC) {
-                std::string_view var_name = node->left.get()->value.text;
-                auto it = std::find(captured.begin(), captured.end(), var_name);
-                if (it == captured.end())
-                    throw std::runtime_error("Unknown variable");
-                int position = std::distance(captured.begin(), it) + 1;
-                promote_set.elements.insert(position);
-            } else {
-                auto sub_set = convert_subset_dbj(node->left.get(),
-                                                  lambda_depth, captured);
-                promote_set.elements.insert(
-                    std::make_shared<SLC_set>(std::move(sub_set)));
-            }
-            ret_set.elements.insert(
-                std::make_shared<SLC_set>(std::move(promote_set)));
-            if (node->right.get()->type == ULC_AST_type::ATOMIC) {
-                std::string_view var_name = node->right.get()->value.text;
-                auto it = std::find(captured.begin(), captured.end(), var_name);
-                if (it == captured.end())
-                    throw std::runtime_error("Unknown variable");
-                int position = std::distance(captured.begin(), it) + 1;
-                ret_set.elements.insert(position);
-            } else {
-                auto sub_set = convert_subset_dbj(node->right.get(),
-                                                  lambda_depth, captured);
-                ret_set.elements.insert(
-                    std::make_shared<SLC_set>(std::move(sub_set)));
-            }
-        }
-            return ret_set;
-            break;
-        case ULC_AST_type::GROUP:
-            return convert_subset_dbj(node->right.get(), lambda_depth,
-                                      captured);
-        }
-        return ret_set;
-    }
+// balanced parentheses bitstreams, see toposet_bp.hpp. toposet_reducer
+// decodes them from a file or through its parse_bp export, str must outlive
+// the call
+std::string ulc2dbj_bp(std::string_view str) {
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    SLC_set set = converter.convert_dbj();
+    toposet_bp bp;
+    bp.encode(converter.store_, set.id);
+    return bp.to_bytes();
+}
 
-    SLC_set make_number(int number) {
-        // 1 = {{{},{}}}
-        // 2 = {{{},{}}, {}}
-        // 3 = {{{},{}}, {}, {}}
-        // ...
-        SLC_set num_base_r;
-        SLC_set num_base_l;
-        SLC_set num_base;
-        num_base.elements.insert(
-            std::make_shared<SLC_set>(std::move(num_base_r)));
-        num_base.elements.insert(
-            std::make_shared<SLC_set>(std::move(num_base_l)));
-        SLC_set num_top;
-        num_top.elements.insert(std::make_shared<SLC_set>(std::move(num_base)));
-        for (int i = 1; i < number; i++) {
-            SLC_set extra;
-            num_top.elements.insert(
-                std::make_shared<SLC_set>(std::move(extra)));
-        }
-        return num_top;
-    }
+std::string ulc2slc_bp(std::string_view str) {
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    SLC_set set = converter.convert();
+    toposet_bp bp;
+    bp.encode(converter.store_, set.id);
+    return bp.to_bytes();
+}
 
-    SLC_set convert_subset(const ULC_AST_node *node, int lambda_depth,
-                           std::vector<std::string_view> captured) {
-        SLC_set ret_set;
-        if (!node)
-            return ret_set;
-        switch (node->type) {
-        case ULC_AST_type::DEFINITION: {
-            SLC_set lambda_top;
-            SLC_set lambda_base;
-            lambda_top.elements.insert(
-                std::make_shared<SLC_set>(std::move(lambda_base)));
-            ret_set.elements.insert(
-                std::make_shared<SLC_set>(std::move(lambda_top)));
-            captured.insert(captured.begin(), node->right.get()->value.text);
-            if (node->left.get()->type == ULC_AST_type::ATOMIC) {
-                std::string_view var_name = node->left.get()->value.text;
-                auto it = std::find(captured.begin(), captured.end(), var_name);
-                if (it == captured.end())
-                    throw std::runtime_error("Unknown variable");
-                int position = std::distance(captured.begin(), it) + 1;
-                ret_set.elements.insert(
-                    std::make_shared<SLC_set>(make_number(position)));
-            } else {
-                auto sub_set = convert_subset(node->left.get(),
-                                              lambda_depth + 1, captured);
-                ret_set.elements.insert(
-                    std::make_shared<SLC_set>(std::move(sub_set)));
-            }
-            captured.erase(captured.begin());
-        }
-            return ret_set;
-            break;
-        case ULC_AST_type::APPLICATION: {
-            SLC_set promote_set;
-            if (node->left.get()->type == ULC_AST_type::ATOMIC) {
-                std::string_view var_name = node->left.get()->value.text;
-                auto it = std::find(captured.begin(), captured.end(), var_name);
-                if (it == captured.end())
-                    throw std::runtime_error("Unknown variable");
-                int position = std::distance(captured.begin(), it) + 1;
-                promote_set.elements.insert(
-                    std::make_shared<SLC_set>(make_number(position)));
-            } else {
-                auto sub_set =
-                    convert_subset(node->left.get(), lambda_depth, captured);
-                promote_set.elements.insert(
-                    std::make_shared<SLC_set>(std::move(sub_set)));
-            }
-            ret_set.elements.insert(
-                std::make_shared<SLC_set>(std::move(promote_set)));
-            if (node->right.get()->type == ULC_AST_type::ATOMIC) {
-                std::string_view var_name = node->right.get()->value.text;
-                auto it = std::find(captured.begin(), captured.end(), var_name);
-                if (it == captured.end())
-                    throw std::runtime_error("Unknown variable");
-                int position = std::distance(captured.begin(), it) + 1;
-                ret_set.elements.insert(
-                    std::make_shared<SLC_set>(make_number(position)));
-            } else {
-                auto sub_set =
-                    convert_subset(node->right.get(), lambda_depth, captured);
-                ret_set.elements.insert(
-                    std::make_shared<SLC_set>(std::move(sub_set)));
-            }
-        }
-            return ret_set;
-            break;
-        case ULC_AST_type::GROUP:
-            return convert_subset(node->right.get(), lambda_depth, captured);
-            break;
-        }
-        throw std::runtime_error("Huh??");
-        return ret_set;
-    }
-};
+// flat pre-order nodes of the last ulc2*_flat call. Views handed to
+// JavaScript point into this buffer, so they are only valid until the next
+// call and must not be kept across memory growth
+static std::vector<toposet_node> flat_nodes;
 
-void display(std::string_view str) {
-    std::cout << "λ: " << str << std::endl;
+const std::vector<toposet_node> &ulc2dbj_flat(std::string str) {
     ULC_converter converter(str);
-    std::cout << "De Bruijn: " << converter.convert_dbj().to_string()
-              << std::endl;
-    std::cout << "SLC: " << converter.convert().to_string() << std::endl
-              << std::endl;
+    ULC_stats_scope record{converter.stats_};
+    toposet_flatten(converter.store_, converter.convert_dbj().id, flat_nodes);
+    return flat_nodes;
 }
 
-int main() {
-    std::cout << "Identity:" << std::endl;
-    display("\\x.x");
+const std::vector<toposet_node> &ulc2slc_flat(std::string str) {
+    ULC_converter converter(str);
+    ULC_stats_scope record{converter.stats_};
+    toposet_flatten(converter.store_, converter.convert().id, flat_nodes);
+    return flat_nodes;
+}
 
-    std::cout << "K-Combinator:" << std::endl;
-    display("\\x.\\y.x");
+#ifdef __EMSCRIPTEN__
+// Uint32Array over flat_nodes without copying, toposet_node_words per node
+static emscripten::val flat_view(const std::vector<toposet_node> &nodes) {
+    return emscripten::val(emscripten::typed_memory_view(
+        nodes.size() * toposet_node_words,
+        reinterpret_cast<const std::uint32_t *>(nodes.data())));
+}
 
-    std::cout << "S-Combinator:" << std::endl;
-    display("\\x.\\y.\\z.((x z)(y z))");
+// shapes as plain numbers, exact up to 2^53
+static emscripten::val shape_object(const ULC_shape &shape) {
+    emscripten::val out = emscripten::val::object();
+    out.set("nodes", static_cast<double>(shape.nodes));
+    out.set("depth", static_cast<double>(shape.depth));
+    out.set("bytes", static_cast<double>(shape.bytes));
+    return out;
+}
 
-    std::cout << "Fixed-Point Combinator:" << std::endl;
-    display("(\\f.(\\x.f (x x)) (\\x.f (x x)))");
+emscripten::val ulc2dbj_shape_js(std::string str) {
+    return shape_object(ulc2dbj_shape(std::move(str)));
+}
 
-    std::cout << "0:" << std::endl;
-    display("(\\f.(\\x.x))");
+emscripten::val ulc2slc_shape_js(std::string str) {
+    return shape_object(ulc2slc_shape(std::move(str)));
+}
 
-    std::cout << "Succ:" << std::endl;
-    display("(\\n.\\f.\\x.f(n f x))");
+// ulc_stats() as an object of plain numbers, with enabled telling whether
+// the build collects them at all
+emscripten::val ulc_stats_js() {
+    toposet_stats stats = ulc_stats();
+    emscripten::val out = emscripten::val::object();
+    out.set("enabled", toposet_stats_enabled);
+    out.set("nodes_visited", static_cast<double>(stats.nodes_visited));
+    out.set("sets_allocated", static_cast<double>(stats.sets_allocated));
+    out.set("leaf_sets", static_cast<double>(stats.leaf_sets));
+    out.set("bytes_emitted", static_cast<double>(stats.bytes_emitted));
+    out.set("max_depth", static_cast<double>(stats.max_depth));
+    out.set("cache_hits", static_cast<double>(stats.cache_hits));
+    out.set("cache_misses", static_cast<double>(stats.cache_misses));
+    out.set("lex_ns", static_cast<double>(stats.lex_ns));
+    out.set("parse_ns", static_cast<double>(stats.parse_ns));
+    out.set("convert_ns", static_cast<double>(stats.convert_ns));
+    out.set("serialize_ns", static_cast<double>(stats.serialize_ns));
+    return out;
+}
 
-    std::cout << "+:" << std::endl;
-    display("\\m.\\k.m (\\n.\\f.\\x.f(n f x)) k");
+// bitstreams as a Uint8Array copy, a std::string would be decoded as UTF-8
+static emscripten::val bytes_array(const std::string &bytes) {
+    emscripten::val view(emscripten::typed_memory_view(
+        bytes.size(), reinterpret_cast<const unsigned char *>(bytes.data())));
+    return emscripten::val::global("Uint8Array").new_(view);
 }
 
-std::string ulc2dbj(std::string str) {
-    ULC_converter converter(str);
-    return std::string(converter.convert_dbj().to_string());
+emscripten::val ulc2dbj_bp_js(std::string str) {
+    return bytes_array(ulc2dbj_bp(str));
 }
 
-std::string ulc2slc(std::string str) {
-    ULC_converter converter(str);
-    return std::string(converter.convert().to_string());
+emscripten::val ulc2slc_bp_js(std::string str) {
+    return bytes_array(ulc2slc_bp(str));
+}
+
+emscripten::val ulc2dbj_view(std::string str) {
+    return flat_view(ulc2dbj_flat(std::move(str)));
+}
+
+emscripten::val ulc2slc_view(std::string str) {
+    return flat_view(ulc2slc_flat(std::move(str)));
+}
+#endif
+
+// interned sets kept between batch items before the store is recycled
+constexpr size_t ULC_batch_store_limit = 1 << 20;
+
+// converts every input with one reusable converter so the AST arena, token
+// buffer, work stacks and leaf caches are only allocated once per batch
+template <typename Convert>
+std::vector<std::string> convert_batch(const std::vector<std::string> &inputs,
+                                       Convert convert) {
+    ULC_converter converter;
+    ULC_stats_scope record{converter.stats_};
+    std::vector<std::string> results;
+    results.reserve(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (converter.store_.size() > ULC_batch_store_limit)
+            converter.clear_store();
+        try {
+            converter.load(inputs[i]);
+            std::string out;
+            converter.serialize(convert(converter), out);
+            results.push_back(std::move(out));
+        } catch (const std::runtime_error &e) {
+            throw std::runtime_error("Expression " + std::to_string(i) +
+                                     ": " + e.what());
+        }
+    }
+    return results;
+}
+
+// number of batch items a worker claims at a time
+constexpr size_t ULC_parallel_chunk = 64;
+
+// converts inputs across a pool of worker threads. Each worker owns its own
+// converter, so arenas, stores and leaf caches are never shared and the only
+// synchronization is claiming the next chunk of items
+template <typename Convert>
+std::vector<std::string>
+convert_batch_parallel(const std::vector<std::string> &inputs, Convert convert,
+                       unsigned threads) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunks = (inputs.size() + ULC_parallel_chunk - 1) /
+                    ULC_parallel_chunk;
+    threads = static_cast<unsigned>(std::min<size_t>(threads, chunks));
+    if (threads <= 1)
+        return convert_batch(inputs, convert);
+
+    std::vector<std::string> results(inputs.size());
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    // keeps the first error and stops handing out work to every worker
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+            error = e;
+        next.store(inputs.size());
+    };
+
+    auto worker = [&]() {
+        try {
+            ULC_converter converter;
+            ULC_stats_scope record{converter.stats_};
+            while (true) {
+                size_t begin = next.fetch_add(ULC_parallel_chunk);
+                if (begin >= inputs.size())
+                    return;
+                size_t end =
+                    std::min(begin + ULC_parallel_chunk, inputs.size());
+                for (size_t i = begin; i < end; i++) {
+                    if (converter.store_.size() > ULC_batch_store_limit)
+                        converter.clear_store();
+                    try {
+                        converter.load(inputs[i]);
+                        convert(converter).serialize(results[i]);
+                    } catch (const std::runtime_error &e) {
+                        fail(std::make_exception_ptr(std::runtime_error(
+                            "Expression " + std::to_string(i) + ": " +
+                            e.what())));
+                        return;
+                    }
+                }
+            }
+        } catch (...) {
+            // anything else, such as bad_alloc, must not leave the thread
+            fail(std::current_exception());
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads);
+    for (unsigned t = 0; t < threads; t++)
+        pool.emplace_back(worker);
+    for (std::thread &t : pool)
+        t.join();
+
+    if (error)
+        std::rethrow_exception(error);
+    return results;
+}
+
+std::vector<std::string> ulc2dbj_batch(const std::vector<std::string> &inputs) {
+    return convert_batch(inputs, [](ULC_converter &converter) {
+        return converter.convert_dbj();
+    });
+}
+
+std::vector<std::string> ulc2slc_batch(const std::vector<std::string> &inputs) {
+    return convert_batch(inputs, [](ULC_converter &converter) {
+        return converter.convert();
+    });
 }
 
+// threads = 0 uses every hardware thread
+std::vector<std::string>
+ulc2dbj_parallel(const std::vector<std::string> &inputs, unsigned threads) {
+    return convert_batch_parallel(
+        inputs,
+        [](ULC_converter &converter) { return converter.convert_dbj(); },
+        threads);
+}
+
+std::vector<std::string>
+ulc2slc_parallel(const std::vector<std::string> &inputs, unsigned threads) {
+    return convert_batch_parallel(
+        inputs, [](ULC_converter &converter) { return converter.convert(); },
+        threads);
+}
+
+// state of an interactive editor. The store is kept between updates, so the
+// parts of an expression an edit did not touch intern to the same sets as
+// before. Each layout is compared with the one before it, see
+// toposet_damage, so a renderer only needs the pre-order range that changed
+// and the sets around it. Parsing and layout are still full linear passes,
+// since an edit can change binder scopes anywhere after it and a resized set
+// moves everything after it
+#ifdef __EMSCRIPTEN__
+// cancellation hook of sessions, true once the request being converted has
+// been superseded. Module.isCancelled is set up by topology_worker.js
+EM_JS(bool, ulc_js_cancelled, (), {
+    return !!(Module.isCancelled && Module.isCancelled());
+});
+#endif
+
+struct ULC_session {
+    static constexpr SLC_id none = ULC_converter::SLC_none;
+
+    std::string text_;
+    ULC_converter converter_;
+    SLC_id dbj_ = none;
+    SLC_id slc_ = none;
+    // flat pre-order view of the current SLC set
+    std::vector<toposet_node> nodes_;
+    // boxes of nodes_ laid out by the last relayout() call
+    std::vector<toposet_box> boxes_;
+    // the view and boxes of the relayout() before, and how the last one
+    // differs from them
+    std::vector<toposet_node> shown_nodes_;
+    std::vector<toposet_box> shown_boxes_;
+    toposet_damage damage_;
+    size_t store_limit_ = ULC_batch_store_limit;
+    std::string error_;
+
+    ULC_session() {
+#ifdef __EMSCRIPTEN__
+        converter_.cancelled_ = ulc_js_cancelled;
+#endif
+    }
+
+    // converts text, returning false if it is unchanged. On error the
+    // previous result is kept and the exception is rethrown
+    bool update(std::string text) {
+        ULC_stats_scope record{converter_.stats_};
+        if (slc_ != none && text == text_)
+            return false;
+        std::string previous_text = std::move(text_);
+        text_ = std::move(text);
+        bool recycled = false;
+        SLC_id dbj, slc;
+        try {
+            if (converter_.store_.size() > store_limit_) {
+                converter_.clear_store();
+                recycled = true;
+            }
+            converter_.load(text_);
+            ULC_conversion result = converter_.convert_both();
+            dbj = result.dbj.id;
+            slc = result.slc.id;
+        } catch (...) {
+            text_ = std::move(previous_text);
+            // ids are gone once the store is recycled
+            if (recycled)
+                dbj_ = slc_ = none;
+            throw;
+        }
+        dbj_ = dbj;
+        slc_ = slc;
+        toposet_flatten(converter_.store_, slc_, nodes_);
+        return true;
+    }
+
+    // update for callers that do not catch C++ exceptions, such as the web
+    // worker: 1 if the text changed, 0 if not, -1 on an error described by
+    // error() and -2 if the conversion was cancelled
+    int try_update(std::string text) {
+        error_.clear();
+        try {
+            return update(std::move(text)) ? 1 : 0;
+        } catch (const ULC_cancelled &) {
+            return -2;
+        } catch (const std::exception &e) {
+            error_ = e.what();
+            return -1;
+        }
+    }
+
+    const std::string &error() const { return error_; }
+
+    std::string dbj() const {
+        return dbj_ == none ? "" : converter_.store_.to_string(dbj_);
+    }
+    std::string slc() const {
+        return slc_ == none ? "" : converter_.store_.to_string(slc_);
+    }
+
+    // lays out the current view into boxes_ and records in damage_ how it
+    // differs from the view and boxes of the previous call
+    void relayout() {
+        toposet_layout(nodes_, boxes_);
+        toposet_diff(shown_nodes_, shown_boxes_, nodes_, boxes_, damage_);
+        shown_nodes_ = nodes_;
+        shown_boxes_ = boxes_;
+    }
+
+#ifdef __EMSCRIPTEN__
+    // views into the session, valid until the next update
+    emscripten::val view() const { return flat_view(nodes_); }
+    // Float32Array of toposet_box_words per node of view(), see relayout
+    emscripten::val layout() {
+        relayout();
+        return emscripten::val(emscripten::typed_memory_view(
+            boxes_.size() * toposet_box_words,
+            reinterpret_cast<const float *>(boxes_.data())));
+    }
+    // damage_ of the last layout() as { start, old_end, end, shift,
+    // patches }, patches a Uint32Array valid until the next layout()
+    emscripten::val damage() const {
+        emscripten::val out = emscripten::val::object();
+        out.set("start", damage_.start);
+        out.set("old_end", damage_.old_end);
+        out.set("end", damage_.end);
+        out.set("shift", damage_.shift);
+        out.set("patches",
+                emscripten::val(emscripten::typed_memory_view(
+                    damage_.patches.size(), damage_.patches.data())));
+        return out;
+    }
+#endif
+};
+
+#ifdef __EMSCRIPTEN__
 // emscripten bindings
 EMSCRIPTEN_BINDINGS(toposet) {
+    emscripten::register_vector<std::string>("StringList");
     emscripten::function("ulc2dbj", &ulc2dbj);
     emscripten::function("ulc2slc", &ulc2slc);
+    emscripten::function("ulc2both", &ulc2both);
+    emscripten::function("normalize", &ulc_normalize);
+    emscripten::function("ulc2dbj_normal", &ulc2dbj_normal);
+    emscripten::function("ulc2slc_normal", &ulc2slc_normal);
+    emscripten::function("ulc2dbj_shape", &ulc2dbj_shape_js);
+    emscripten::function("ulc2slc_shape", &ulc2slc_shape_js);
+    emscripten::function("ulc2dbj_view", &ulc2dbj_view);
+    emscripten::function("ulc2dbj_bp", &ulc2dbj_bp_js);
+    emscripten::function("ulc2slc_bp", &ulc2slc_bp_js);
+    emscripten::function("cache_limit", &ulc_cache_limit);
+    emscripten::function("cache_clear", &ulc_cache_clear);
+    emscripten::function("stats", &ulc_stats_js);
+    emscripten::function("stats_reset", &ulc_stats_reset);
+    emscripten::function("ulc2slc_view", &ulc2slc_view);
+    emscripten::function("ulc2dbj_batch", &ulc2dbj_batch);
+    emscripten::function("ulc2slc_batch", &ulc2slc_batch);
+    emscripten::class_<ULC_session>("Session")
+        .constructor<>()
+        .function("update", &ULC_session::update)
+        .function("try_update", &ULC_session::try_update)
+        .function("error", &ULC_session::error)
+        .function("dbj", &ULC_session::dbj)
+        .function("slc", &ULC_session::slc)
+        .function("view", &ULC_session::view)
+        .function("layout", &ULC_session::layout)
+        .function("damage", &ULC_session::damage);
+#ifdef __EMSCRIPTEN_PTHREADS__
+    emscripten::function("ulc2dbj_parallel", &ulc2dbj_parallel);
+    emscripten::function("ulc2slc_parallel", &ulc2slc_parallel);
+#endif
+}
+#endif
+
+#if !defined(__EMSCRIPTEN__) && !defined(TOPOSET_CORE)
+// converts one line of a bulk input, reusing its converter across lines
+struct ULC_line_worker {
+    bool dbj_;
+    bool normalize_;
+    ULC_converter converter_;
+    ULC_reducer reducer_;
+    ULC_stats_scope record_{converter_.stats_};
+
+    ULC_line_worker(bool dbj, bool normalize)
+        : dbj_(dbj), normalize_(normalize) {}
+
+    void operator()(std::string_view line, std::string &out) {
+        if (converter_.store_.size() > ULC_batch_store_limit)
+            converter_.clear_store();
+        converter_.load(line);
+        if (normalize_) {
+            reducer_.reduce(converter_.ast_);
+            std::swap(converter_.ast_, reducer_.out_);
+        }
+        converter_.serialize(
+            dbj_ ? converter_.convert_dbj() : converter_.convert(), out);
+    }
+};
+
+// ulc2toposet [--dbj] [--normalize] [-j threads] input [output]
+// ulc2toposet [--dbj] --stream | --bp input [output]
+//
+// converts every line of input, which is mapped and parsed in place, to SLC
+// or with --dbj to De Bruijn sets, one result per line. --normalize reduces
+// each term to normal form first. Output goes to stdout unless given, and
+// -j 0 converts on every hardware thread.
+//
+// --stream and --bp read the whole input as one term. --stream writes its
+// text straight from the AST in ULC_stream_chunk pieces, so output far
+// larger than memory never exists as a whole. --bp writes the bitstream
+// that toposet_reducer reads back
+int ulc_cli(int argc, char **argv) {
+    bool dbj = false;
+    bool normalize = false;
+    bool stream = false;
+    bool bp = false;
+    unsigned threads = 1;
+    bool usage = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--dbj")
+            dbj = true;
+        else if (arg == "--normalize")
+            normalize = true;
+        else if (arg == "--stream")
+            stream = true;
+        else if (arg == "--bp")
+            bp = true;
+        else if (arg == "-j" && i + 1 < argc)
+            threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (!arg.empty() && arg[0] != '-')
+            paths.push_back(arg);
+        else
+            usage = true;
+    }
+    if ((stream || bp) && (normalize || (stream && bp)))
+        usage = true;
+    if (usage || paths.empty() || paths.size() > 2) {
+        std::cerr << "usage: ulc2toposet [--dbj] [--normalize] [-j threads] "
+                     "input [output]\n"
+                     "       ulc2toposet [--dbj] --stream | --bp input "
+                     "[output]"
+                  << std::endl;
+        return 2;
+    }
+    mapped_file input(paths[0]);
+    if (stream || bp) {
+        std::ofstream file;
+        if (paths.size() == 2) {
+            file.open(paths[1], std::ios::binary);
+            if (!file)
+                throw std::runtime_error("Could not open " + paths[1]);
+        }
+        std::ostream &out = paths.size() == 2 ? file : std::cout;
+        if (bp) {
+            std::string bytes =
+                dbj ? ulc2dbj_bp(input.view()) : ulc2slc_bp(input.view());
+            out.write(bytes.data(), bytes.size());
+        } else {
+            if (dbj)
+                ulc2dbj_stream(input.view(), out);
+            else
+                ulc2slc_stream(input.view(), out);
+            out << '\n';
+        }
+        if (!out.flush())
+            throw std::runtime_error("Could not write output");
+        if constexpr (toposet_stats_enabled)
+            ulc_stats().print(std::cerr);
+        return 0;
+    }
+    int fd = STDOUT_FILENO;
+    if (paths.size() == 2) {
+        fd = open(paths[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Could not open " + paths[1]);
+    }
+    size_t failed = convert_lines(input.view(), fd, threads, [&] {
+        return ULC_line_worker(dbj, normalize);
+    });
+    if (fd != STDOUT_FILENO)
+        close(fd);
+    if constexpr (toposet_stats_enabled)
+        ulc_stats().print(std::cerr);
+    return failed ? 1 : 0;
 }
+#endif
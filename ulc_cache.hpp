@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// bytes of entries kept by a ULC_cache unless set_limit says otherwise
+constexpr size_t ULC_cache_default_limit = 16 << 20;
+
+// subterms shorter than this many words are written out rather than looked
+// up, a probe costs about as much as the text of a small term
+constexpr size_t ULC_cache_min_words = 8;
+
+// LRU cache of converted text keyed by the name free form of a term, so
+// alpha equivalent inputs share an entry. A term is its pre-order words:
+// 0 for a definition, 1 for an application followed by its left then right
+// side, 2 for an empty group and index + 2 for a variable, the same words
+// ULC_converter::build_terms writes. The hash only picks the bucket, words
+// are compared in full so a collision is a miss and never a wrong result
+struct ULC_cache {
+    struct entry {
+        std::uint64_t hash;
+        std::vector<std::uint32_t> term;
+        std::string text;
+    };
+
+    std::list<entry> lru_;
+    std::unordered_map<std::uint64_t, std::list<entry>::iterator> index_;
+    size_t limit_;
+    size_t bytes_ = 0;
+
+    explicit ULC_cache(size_t limit = ULC_cache_default_limit)
+        : limit_(limit) {}
+    // index_ refers into lru_
+    ULC_cache(const ULC_cache &) = delete;
+    ULC_cache &operator=(const ULC_cache &) = delete;
+
+    bool empty() const { return lru_.empty(); }
+    size_t size() const { return lru_.size(); }
+    size_t bytes() const { return bytes_; }
+
+    // text cached for term, marked most recently used, nullptr on a miss.
+    // The pointer is valid until the next insert, set_limit or clear
+    const std::string *find(std::uint64_t hash, const std::uint32_t *term,
+                            size_t len) {
+        auto it = index_.find(hash);
+        if (it == index_.end() || !same_term(*it->second, term, len))
+            return nullptr;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return &it->second->text;
+    }
+
+    // adds or replaces the entry for term, then evicts the least recently
+    // used entries until the cache fits its limit again. An entry larger
+    // than the whole limit is not kept
+    void insert(std::uint64_t hash, const std::uint32_t *term, size_t len,
+                std::string text) {
+        auto it = index_.find(hash);
+        if (it != index_.end())
+            erase(it->second);
+        entry e{hash, std::vector<std::uint32_t>(term, term + len),
+                std::move(text)};
+        if (bytes_of(e) > limit_)
+            return;
+        bytes_ += bytes_of(e);
+        lru_.push_front(std::move(e));
+        index_.emplace(hash, lru_.begin());
+        evict();
+    }
+
+    void set_limit(size_t limit) {
+        limit_ = limit;
+        evict();
+    }
+
+    void clear() {
+        lru_.clear();
+        index_.clear();
+        bytes_ = 0;
+    }
+
+  private:
+    // payload plus the list and index nodes holding it
+    static size_t bytes_of(const entry &e) {
+        return sizeof(entry) + 4 * sizeof(void *) + sizeof(std::uint64_t) +
+               e.term.size() * sizeof(std::uint32_t) + e.text.size();
+    }
+
+    static bool same_term(const entry &e, const std::uint32_t *term,
+                          size_t len) {
+        return e.term.size() == len &&
+               (len == 0 ||
+                std::memcmp(e.term.data(), term, len * sizeof(*term)) == 0);
+    }
+
+    void erase(std::list<entry>::iterator it) {
+        bytes_ -= bytes_of(*it);
+        index_.erase(it->hash);
+        lru_.erase(it);
+    }
+
+    void evict() {
+        while (bytes_ > limit_ && !lru_.empty())
+            erase(std::prev(lru_.end()));
+    }
+};
@@ -0,0 +1,1337 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "slc_set.hpp"
+#include "toposet_stats.hpp"
+#include "ulc_cache.hpp"
+
+// lexer, parser and converter from untyped lambda calculus to De Bruijn and
+// SLC sets, shared by ulc2toposet and the benchmarks
+
+enum class ULC_token_type {
+    LAMBDA,
+    VARIABLE,
+    DOT,
+    O_PAREN,
+    C_PAREN,
+    EOF_TOK,
+};
+
+struct ULC_token {
+    ULC_token() : type(ULC_token_type::EOF_TOK) {}
+    ULC_token(ULC_token_type t, int p) : type(t), pos(p) {}
+    ULC_token(ULC_token_type t, std::string_view s, int p)
+        : type(t), text(s), pos(p) {}
+
+    ULC_token_type type;
+    std::string_view text;
+    int pos = 0;
+    // interned id of a VARIABLE's text, equal names share an id
+    std::uint32_t name = 0;
+};
+
+// byte classes of the lexer. Anything not listed is invalid, including
+// every non ASCII byte, which is what <cctype> gives in the "C" locale
+enum ULC_char_class : std::uint8_t {
+    ULC_CHAR_INVALID,
+    ULC_CHAR_SPACE,
+    ULC_CHAR_NAME,
+    ULC_CHAR_PUNCT,
+};
+
+constexpr std::array<std::uint8_t, 256> ULC_make_char_classes() {
+    std::array<std::uint8_t, 256> classes = {};
+    for (int ch = '\t'; ch <= '\r'; ch++)
+        classes[ch] = ULC_CHAR_SPACE;
+    classes[' '] = ULC_CHAR_SPACE;
+    for (int ch = '0'; ch <= '9'; ch++)
+        classes[ch] = ULC_CHAR_NAME;
+    for (int ch = 'a'; ch <= 'z'; ch++)
+        classes[ch] = ULC_CHAR_NAME;
+    for (int ch = 'A'; ch <= 'Z'; ch++)
+        classes[ch] = ULC_CHAR_NAME;
+    for (char ch : {'.', '\\', '(', ')'})
+        classes[static_cast<unsigned char>(ch)] = ULC_CHAR_PUNCT;
+    return classes;
+}
+
+constexpr std::array<std::uint8_t, 256> ULC_char_classes =
+    ULC_make_char_classes();
+
+struct ULC_lexer {
+    std::string_view text_;
+    int pos_;
+    // ids handed out to variable names so far
+    std::unordered_map<std::string_view, std::uint32_t> names_;
+    ULC_lexer(std::string_view text) : text_(text), pos_(0) {}
+
+    std::uint8_t char_class(size_t pos) const {
+        return ULC_char_classes[static_cast<unsigned char>(text_[pos])];
+    }
+
+    ULC_token next_token() {
+        size_t len = text_.size();
+        size_t pos = pos_;
+        // whitespace handling
+        while (pos < len && char_class(pos) == ULC_CHAR_SPACE)
+            pos++;
+        pos_ = static_cast<int>(pos);
+        if (pos >= len)
+            return ULC_token(ULC_token_type::EOF_TOK, pos_);
+
+        int original_pos = pos_;
+        switch (char_class(pos)) {
+        case ULC_CHAR_PUNCT: {
+            pos_++;
+            std::string_view text = text_.substr(pos, 1);
+            switch (text[0]) {
+            case '.':
+                return ULC_token(ULC_token_type::DOT, text, original_pos);
+            case '\\':
+                return ULC_token(ULC_token_type::LAMBDA, text, original_pos);
+            case '(':
+                return ULC_token(ULC_token_type::O_PAREN, text, original_pos);
+            default:
+                return ULC_token(ULC_token_type::C_PAREN, text, original_pos);
+            }
+        }
+        case ULC_CHAR_NAME: {
+            while (pos < len && char_class(pos) == ULC_CHAR_NAME)
+                pos++;
+            pos_ = static_cast<int>(pos);
+            ULC_token token(ULC_token_type::VARIABLE,
+                            text_.substr(original_pos, pos - original_pos),
+                            original_pos);
+            auto it = names_.try_emplace(
+                token.text, static_cast<std::uint32_t>(names_.size()));
+            token.name = it.first->second;
+            return token;
+        }
+        default:
+            throw std::runtime_error("Invalid token");
+        }
+    }
+
+    // lexes the whole input into tokens, which ends with one EOF token.
+    // tokens grows geometrically and keeps its capacity between inputs, a
+    // reservation from the text length would cost a token per byte
+    void tokenize(std::vector<ULC_token> &tokens) {
+        tokens.clear();
+        do {
+            tokens.push_back(next_token());
+        } while (tokens.back().type != ULC_token_type::EOF_TOK);
+    }
+};
+
+enum class ULC_AST_type {
+    APPLICATION,
+    DEFINITION,
+    ATOMIC,
+    GROUP,
+};
+
+// AST nodes live in one contiguous ULC_AST and refer to their children by
+// 32 bit index
+using ULC_AST_id = std::uint32_t;
+constexpr ULC_AST_id ULC_AST_null = UINT32_MAX;
+
+struct ULC_AST_node {
+    ULC_AST_type type;
+    ULC_AST_id right = ULC_AST_null;
+    ULC_AST_id left = ULC_AST_null;
+    // position of an ATOMIC variable's token in the parser's token list,
+    // the token itself is only needed while parsing
+    std::uint32_t token = 0;
+    // De Bruijn index of an ATOMIC variable, resolved by the parser
+    int index = 0;
+
+    ULC_AST_node(ULC_AST_type t) : type(t) {}
+};
+
+// bump arena holding every node of a parse, nodes are only ever appended and
+// a failed parse branch is discarded by truncating back to a mark
+struct ULC_AST {
+    std::vector<ULC_AST_node> nodes_;
+    ULC_AST_id root_ = ULC_AST_null;
+
+    ULC_AST_id add(ULC_AST_node node) {
+        nodes_.push_back(node);
+        return static_cast<ULC_AST_id>(nodes_.size() - 1);
+    }
+
+    ULC_AST_node &operator[](ULC_AST_id id) { return nodes_[id]; }
+    const ULC_AST_node &operator[](ULC_AST_id id) const { return nodes_[id]; }
+
+    // nullptr for ULC_AST_null so converters can test missing children
+    const ULC_AST_node *get(ULC_AST_id id) const {
+        return id == ULC_AST_null ? nullptr : &nodes_[id];
+    }
+
+    const ULC_AST_node *root() const { return get(root_); }
+
+    size_t mark() const { return nodes_.size(); }
+    void release(size_t mark) {
+        nodes_.erase(nodes_.begin() + mark, nodes_.end());
+    }
+
+    void clear() {
+        nodes_.clear();
+        root_ = ULC_AST_null;
+    }
+};
+
+// binder environment used for name resolution. Binders live on one shared
+// stack and each name maps to the stack depth of its innermost binder, the
+// depth it shadowed is kept on the stack so leaving a binder restores it
+struct ULC_scope {
+    struct binder {
+        std::uint32_t name;
+        int shadowed;
+    };
+    std::vector<binder> binders_;
+    // stack depth of the innermost binder of each name id, 0 if unbound
+    std::vector<int> depth_;
+
+    void push(std::uint32_t name) {
+        if (name >= depth_.size())
+            depth_.resize(name + 1, 0);
+        int &depth = depth_[name];
+        binders_.push_back({name, depth});
+        depth = static_cast<int>(binders_.size());
+    }
+
+    void pop() {
+        binder b = binders_.back();
+        binders_.pop_back();
+        depth_[b.name] = b.shadowed;
+    }
+
+    void clear() {
+        binders_.clear();
+        depth_.clear();
+    }
+
+    // De Bruijn index of name counted from the innermost binder, 0 if the
+    // name is unbound
+    int resolve(std::uint32_t name) const {
+        if (name >= depth_.size() || depth_[name] == 0)
+            return 0;
+        return static_cast<int>(binders_.size()) - depth_[name] + 1;
+    }
+};
+
+// default bound on parser and converter work stacks, deep enough for large
+// generated programs while keeping memory use predictable
+constexpr size_t ULC_max_depth = 1 << 20;
+
+// nodes a converter walks between calls to its cancellation hook
+constexpr size_t ULC_cancel_interval = 1 << 12;
+
+// thrown out of a conversion whose cancellation hook returned true
+struct ULC_cancelled : std::runtime_error {
+    ULC_cancelled() : std::runtime_error("Conversion cancelled") {}
+};
+
+/*
+ * Parse Grammar:
+ *
+ * P := A | P (A | B)
+ * B := 'λ' V '.' E
+ * E := A | B | P
+ * A := '(' E ')' | V
+ *
+ * Important to note this actual structure is modified in implementation to get
+ * around right associativity constraints.
+ */
+
+struct ULC_parser {
+    ULC_lexer lexer_;
+    ULC_AST &ast_;
+    ULC_parser(ULC_lexer lexer, ULC_AST &ast)
+        : lexer_(lexer), ast_(ast), token_id_(0) {
+        lexer_.tokenize(tokens_);
+    }
+    std::vector<ULC_token> tokens_;
+    int token_id_;
+    ULC_scope scope_;
+
+    // point the parser at new input, keeping the capacity of its buffers
+    void reset(ULC_lexer lexer) {
+        lexer_ = lexer;
+        stack_.clear();
+        scope_.clear();
+        token_id_ = 0;
+        lexer_.tokenize(tokens_);
+    }
+
+    const ULC_token &peek() const { return tokens_[token_id_]; }
+
+    // advance to the next token, staying on the final EOF
+    const ULC_token &next_token() {
+        if (static_cast<size_t>(token_id_) + 1 < tokens_.size())
+            token_id_++;
+        return tokens_[token_id_];
+    }
+
+    // true if token of type can be consumed
+    bool consume_type(ULC_token_type type) {
+        if (peek().type == type) {
+            next_token();
+            return true;
+        }
+        return false;
+    }
+
+    // id of ast node of consumed variable
+    ULC_AST_id consume_variable() {
+        if (peek().type == ULC_token_type::VARIABLE) {
+            ULC_AST_node var(ULC_AST_type::ATOMIC);
+            var.token = static_cast<std::uint32_t>(token_id_);
+            ULC_AST_id node = ast_.add(var);
+            next_token();
+            return node;
+        }
+        return ULC_AST_null;
+    }
+
+    // wrapper for parse, stores the root in the ast
+    ULC_AST_id parse() {
+        ast_.root_ = parse_expression();
+        return ast_.root_;
+    }
+
+    // parse states, the grammar is walked with an explicit stack of pending
+    // abstractions, groups and application chains instead of recursing
+    enum class frame_type {
+        ABSTRACTION, // waiting on the body of a definition
+        GROUP,       // waiting on the expression inside parens
+        APPLICATION, // accumulating atomics into a left leaning chain
+    };
+
+    struct frame {
+        frame_type type;
+        ULC_AST_id node;
+        int token_id;
+        size_t mark;
+    };
+
+    std::vector<frame> stack_;
+    size_t max_depth_ = ULC_max_depth;
+
+    void push_frame(frame f) {
+        if (stack_.size() >= max_depth_)
+            throw std::runtime_error("Expression nested too deeply");
+        stack_.push_back(f);
+    }
+
+    // tries to consume the '\' V '.' header of an abstraction. On failure
+    // the tokens and nodes it consumed are given back
+    bool begin_abstraction() {
+        int original_id = token_id_;
+        size_t original_mark = ast_.mark();
+
+        if (consume_type(ULC_token_type::LAMBDA)) {
+            ULC_AST_id node = ast_.add(ULC_AST_node(ULC_AST_type::DEFINITION));
+            ULC_AST_id var = consume_variable();
+            if (var != ULC_AST_null) {
+                ast_[node].right = var;
+                if (consume_type(ULC_token_type::DOT)) {
+                    scope_.push(tokens_[ast_[var].token].name);
+                    push_frame({frame_type::ABSTRACTION, node, original_id,
+                                original_mark});
+                    return true;
+                }
+            }
+        }
+
+        token_id_ = original_id;
+        ast_.release(original_mark);
+        return false;
+    }
+
+    // parses an expression by trying to parse and abstraction then trying to
+    // parse applications
+    ULC_AST_id parse_expression() {
+        enum class state { EXPRESSION, ATOMIC, ATOMIC_DONE, EXPRESSION_DONE };
+        stack_.clear();
+        state st = state::EXPRESSION;
+        ULC_AST_id result = ULC_AST_null;
+
+        while (true) {
+            switch (st) {
+            case state::EXPRESSION:
+                // try to parse an abstraction
+                if (peek().type == ULC_token_type::LAMBDA) {
+                    if (!begin_abstraction()) {
+                        result = ULC_AST_null;
+                        st = state::EXPRESSION_DONE;
+                    }
+                    break;
+                }
+                push_frame({frame_type::APPLICATION, ULC_AST_null, 0, 0});
+                st = state::ATOMIC;
+                break;
+
+            case state::ATOMIC:
+                // try consuming a parenthesized expression
+                if (consume_type(ULC_token_type::O_PAREN)) {
+                    ULC_AST_id node =
+                        ast_.add(ULC_AST_node(ULC_AST_type::GROUP));
+                    push_frame({frame_type::GROUP, node, 0, 0});
+                    st = state::EXPRESSION;
+                    break;
+                }
+                // otherwise consume a variable
+                result = parse_variable();
+                st = state::ATOMIC_DONE;
+                break;
+
+            case state::ATOMIC_DONE: {
+                frame &top = stack_.back();
+                if (result == ULC_AST_null) {
+                    stack_.pop_back();
+                    st = state::EXPRESSION_DONE;
+                    break;
+                }
+                if (top.node == ULC_AST_null) {
+                    top.node = result;
+                } else {
+                    ULC_AST_id app =
+                        ast_.add(ULC_AST_node(ULC_AST_type::APPLICATION));
+                    // rearrange trees for right associativity
+                    ast_[app].left = top.node;
+                    ast_[app].right = result;
+                    top.node = app;
+                }
+                // check for expression start
+                if (peek().type == ULC_token_type::VARIABLE ||
+                    peek().type == ULC_token_type::O_PAREN) {
+                    st = state::ATOMIC;
+                } else {
+                    result = top.node;
+                    stack_.pop_back();
+                    st = state::EXPRESSION_DONE;
+                }
+                break;
+            }
+
+            case state::EXPRESSION_DONE: {
+                if (stack_.empty())
+                    return result;
+                frame top = stack_.back();
+                stack_.pop_back();
+                if (top.type == frame_type::ABSTRACTION) {
+                    scope_.pop();
+                    if (result != ULC_AST_null) {
+                        ast_[top.node].left = result;
+                        result = top.node;
+                    } else {
+                        token_id_ = top.token_id;
+                        ast_.release(top.mark);
+                    }
+                } else {
+                    ast_[top.node].right = result;
+                    if (!consume_type(ULC_token_type::C_PAREN)) {
+                        throw std::runtime_error("Unbalanced parens!");
+                    }
+                    result = top.node;
+                    st = state::ATOMIC_DONE;
+                }
+                break;
+            }
+            }
+        }
+    }
+
+    // consume a variable and bind it to its De Bruijn index
+    ULC_AST_id parse_variable() {
+        ULC_AST_id var = consume_variable();
+        if (var != ULC_AST_null) {
+            ULC_AST_node &node = ast_[var];
+            const ULC_token &token = tokens_[node.token];
+            node.index = scope_.resolve(token.name);
+            if (node.index == 0)
+                throw std::runtime_error(
+                    "Unknown variable '" + std::string(token.text) +
+                    "' at position " + std::to_string(token.pos));
+        }
+        return var;
+    }
+};
+
+// De Bruijn and SLC sets of one expression, interned in the same store
+struct ULC_conversion {
+    SLC_set dbj;
+    SLC_set slc;
+};
+
+// size of a conversion without building it: sets in the output, nesting
+// depth and the exact length of its text
+struct ULC_shape {
+    std::uint64_t nodes = 0;
+    std::uint64_t depth = 0;
+    std::uint64_t bytes = 0;
+};
+
+// driver for converting ULC to SLC sets
+struct ULC_converter {
+    ULC_AST ast_;
+    SLC_store store_;
+    ULC_parser parser_;
+    // filled in only when built with TOPOSET_STATS
+    toposet_stats stats_;
+
+    // empty context, reusable across inputs through load()
+    ULC_converter(size_t max_depth = ULC_max_depth)
+        : parser_(ULC_lexer(""), ast_), max_depth_(max_depth) {
+        parser_.max_depth_ = max_depth;
+    }
+    ULC_converter(std::string_view text, size_t max_depth = ULC_max_depth)
+        : ULC_converter(max_depth) {
+        load(text);
+    }
+    // ast must come from ULC_parser so its variables are already resolved
+    ULC_converter(ULC_AST ast, size_t max_depth = ULC_max_depth)
+        : ULC_converter(max_depth) {
+        ast_ = std::move(ast);
+    }
+    // parser_ refers to ast_
+    ULC_converter(const ULC_converter &) = delete;
+    ULC_converter &operator=(const ULC_converter &) = delete;
+
+    // parses text into the arena, replacing the previous AST. Interned sets
+    // and leaf caches are kept so later conversions can share them, text
+    // must outlive the conversions that follow
+    void load(std::string_view text) {
+        ast_.clear();
+        {
+            toposet_timer timer(stats_.lex_ns);
+            parser_.reset(ULC_lexer(text));
+        }
+        // about one node per token, applications past that grow the arena
+        ast_.nodes_.reserve(parser_.tokens_.size());
+        toposet_timer timer(stats_.parse_ns);
+        parser_.parse();
+    }
+
+    // drops every interned set, invalidating previously returned SLC_sets
+    void clear_store() {
+        store_.clear();
+        lambda_ = SLC_none;
+        numbers_.clear();
+    }
+
+    SLC_set convert() {
+        toposet_timer timer(stats_.convert_ns);
+        size_t sets = store_.size();
+        SLC_id id = convert_subset(ast_.root());
+        record_sets(sets, id);
+        return {&store_, id};
+    }
+
+    SLC_set convert_dbj() {
+        toposet_timer timer(stats_.convert_ns);
+        size_t sets = store_.size();
+        SLC_id id = convert_subset_dbj(ast_.root());
+        record_sets(sets, id);
+        return {&store_, id};
+    }
+
+    // both targets in a single traversal, binder lookups and the walk are
+    // shared and only the leaves differ
+    ULC_conversion convert_both() {
+        toposet_timer timer(stats_.convert_ns);
+        size_t sets = store_.size();
+        both_policy<dbj_policy, slc_policy> policy{{*this}, {*this}, pairs_};
+        auto [dbj, slc] = convert_with(ast_.root(), policy);
+        SLC_id slc_id = std::get<SLC_ref>(slc).id;
+        record_sets(sets, slc_id);
+        return {{&store_, std::get<SLC_ref>(dbj).id}, {&store_, slc_id}};
+    }
+
+    // appends the text of set to out, timed and counted as serialization
+    void serialize(SLC_set set, std::string &out) {
+        toposet_timer timer(stats_.serialize_ns);
+        size_t size = out.size();
+        set.serialize(out);
+        if constexpr (toposet_stats_enabled)
+            stats_.bytes_emitted += out.size() - size;
+    }
+
+    // writes the text of set through sink(data, len), as above
+    template <typename Sink> void serialize(SLC_set set, Sink &&sink) {
+        toposet_timer timer(stats_.serialize_ns);
+        set.serialize([&](const char *data, size_t len) {
+            if constexpr (toposet_stats_enabled)
+                stats_.bytes_emitted += len;
+            sink(data, len);
+        });
+    }
+
+    // new sets since the store held sets entries, and the depth of root
+    void record_sets(size_t sets, SLC_id root) {
+        if constexpr (toposet_stats_enabled) {
+            stats_.sets_allocated += store_.size() - sets;
+            stats_.max_depth = std::max<std::uint64_t>(stats_.max_depth,
+                                                       store_.depth(root));
+        }
+    }
+
+    // dry runs of convert() and convert_dbj(), measured on the AST alone so
+    // no set is interned
+    ULC_shape measure() {
+        shape_policy<true> policy{shapes_};
+        return convert_with(ast_.root(), policy);
+    }
+
+    ULC_shape measure_dbj() {
+        shape_policy<false> policy{shapes_};
+        return convert_with(ast_.root(), policy);
+    }
+
+    SLC_id convert_subset(const ULC_AST_node *root) {
+        slc_policy policy{*this};
+        return std::get<SLC_ref>(convert_with(root, policy)).id;
+    }
+
+    SLC_id convert_subset_dbj(const ULC_AST_node *root) {
+        dbj_policy policy{*this};
+        return std::get<SLC_ref>(convert_with(root, policy)).id;
+    }
+
+    // output policies for convert_with. A policy has a value type, a stack
+    // of them and three builders: variable(index) for a bound variable,
+    // lambda() for the binder marker of a definition and set(elems, count)
+    // for a set of at most two values. The traversal is shared and every
+    // policy gets its own inlined instantiation of it
+
+    // De Bruijn sets, variables stay ints and binders are "λ"
+    struct dbj_policy {
+        ULC_converter &converter;
+        using value = SLC_element;
+        std::vector<value> &values = converter.values_;
+
+        value variable(int index) { return index; }
+        value lambda() { return "λ"; }
+        value set(const value *elems, size_t count) {
+            return SLC_ref{converter.store_.intern(elems, count)};
+        }
+    };
+
+    // fully expanded sets, leaves become the shared number and λ sets
+    struct slc_policy {
+        ULC_converter &converter;
+        using value = SLC_element;
+        std::vector<value> &values = converter.values_;
+
+        value variable(int index) {
+            return SLC_ref{converter.make_number(index)};
+        }
+        value lambda() { return SLC_ref{converter.make_lambda()}; }
+        value set(const value *elems, size_t count) {
+            return SLC_ref{converter.store_.intern(elems, count)};
+        }
+    };
+
+    // two policies fed from one traversal
+    template <typename First, typename Second> struct both_policy {
+        First first;
+        Second second;
+        using value = std::pair<typename First::value, typename Second::value>;
+        std::vector<value> &values;
+
+        value variable(int index) {
+            return {first.variable(index), second.variable(index)};
+        }
+        value lambda() { return {first.lambda(), second.lambda()}; }
+        value set(const value *elems, size_t count) {
+            typename First::value a[2];
+            typename Second::value b[2];
+            for (size_t i = 0; i < count; i++) {
+                a[i] = elems[i].first;
+                b[i] = elems[i].second;
+            }
+            return {first.set(a, count), second.set(b, count)};
+        }
+    };
+
+    // closed form shapes of the leaves and sets convert_with would build,
+    // following SLC_store's text layout. In SLC form a number n is
+    // {{{}, {}}, {}, ...} with n + 3 sets and 4n + 6 bytes, and λ is {{}}.
+    // De Bruijn leaves are text only
+    template <bool SLC> struct shape_policy {
+        using value = ULC_shape;
+        std::vector<value> &values;
+
+        value variable(int index) {
+            if (SLC)
+                return {static_cast<std::uint64_t>(index) + 3, 3,
+                        4 * static_cast<std::uint64_t>(index) + 6};
+            std::uint64_t digits = 1;
+            for (int n = index; n >= 10; n /= 10)
+                digits++;
+            return {0, 0, digits};
+        }
+        value lambda() {
+            if (SLC)
+                return {2, 2, 4};
+            // "λ" is two bytes of UTF-8
+            return {0, 0, 2};
+        }
+        value set(const value *elems, size_t count) {
+            // "{" + "}" + ", " between elements
+            value total{1, 0, count ? 2 * count : 2};
+            for (size_t i = 0; i < count; i++) {
+                total.nodes += elems[i].nodes;
+                total.depth = std::max(total.depth, elems[i].depth);
+                total.bytes += elems[i].bytes;
+            }
+            total.depth++;
+            return total;
+        }
+    };
+
+    // pending conversion of a subtree, children are scheduled on the first
+    // visit and their results collected from the value stack on the second
+    struct frame {
+        const ULC_AST_node *node;
+        bool expanded;
+    };
+
+    size_t max_depth_;
+    // polled every ULC_cancel_interval nodes while walking the AST, a true
+    // result abandons the conversion with ULC_cancelled
+    bool (*cancelled_)() = nullptr;
+    size_t polls_ = 0;
+    std::vector<frame> stack_;
+    // value stacks of the policies, kept so their capacity is reused
+    std::vector<SLC_element> values_;
+    std::vector<std::pair<SLC_element, SLC_element>> pairs_;
+    std::vector<ULC_shape> shapes_;
+
+    void poll() {
+        if (cancelled_ && ++polls_ % ULC_cancel_interval == 0 && cancelled_())
+            throw ULC_cancelled();
+    }
+
+    // parens carry no meaning in either target
+    const ULC_AST_node *skip_groups(const ULC_AST_node *node) const {
+        while (node && node->type == ULC_AST_type::GROUP)
+            node = ast_.get(node->right);
+        return node;
+    }
+
+    bool is_atomic(const ULC_AST_node *node) const {
+        return node && node->type == ULC_AST_type::ATOMIC;
+    }
+
+    // schedules node and every non atomic child below it, leftmost child
+    // ends up on top so results land on the value stack left to right
+    void expand(const ULC_AST_node *node) {
+        if (stack_.size() + 2 >= max_depth_)
+            throw std::runtime_error("Expression nested too deeply");
+        stack_.push_back({node, true});
+        if (!node)
+            return;
+        // an empty group has no node but still converts to {}
+        if (node->type == ULC_AST_type::APPLICATION) {
+            const ULC_AST_node *right = skip_groups(ast_.get(node->right));
+            if (!is_atomic(right))
+                stack_.push_back({right, false});
+        }
+        const ULC_AST_node *left = skip_groups(ast_.get(node->left));
+        if (!is_atomic(left))
+            stack_.push_back({left, false});
+    }
+
+    // converts the subtree at root with policy, definitions become
+    // {λ, body} and applications {right, {left}}
+    template <typename Policy>
+    typename Policy::value convert_with(const ULC_AST_node *root,
+                                        Policy &policy) {
+        using value = typename Policy::value;
+        std::vector<value> &values = policy.values;
+        auto take = [&](const ULC_AST_node *child) {
+            if (is_atomic(child))
+                return policy.variable(child->index);
+            value v = std::move(values.back());
+            values.pop_back();
+            return v;
+        };
+        stack_.clear();
+        values.clear();
+        stack_.push_back({skip_groups(root), false});
+        while (!stack_.empty()) {
+            poll();
+            frame f = stack_.back();
+            stack_.pop_back();
+            const ULC_AST_node *node = f.node;
+            if (!f.expanded) {
+                expand(node);
+                continue;
+            }
+            if (!node) {
+                values.push_back(policy.set(nullptr, 0));
+                continue;
+            }
+            value elems[2];
+            switch (node->type) {
+            case ULC_AST_type::DEFINITION:
+                elems[0] = policy.lambda();
+                elems[1] = take(skip_groups(ast_.get(node->left)));
+                break;
+            case ULC_AST_type::APPLICATION: {
+                elems[0] = take(skip_groups(ast_.get(node->right)));
+                value left = take(skip_groups(ast_.get(node->left)));
+                elems[1] = policy.set(&left, 1);
+            } break;
+            default:
+                throw std::runtime_error("Huh??");
+            }
+            values.push_back(policy.set(elems, 2));
+            if constexpr (toposet_stats_enabled)
+                stats_.nodes_visited++;
+        }
+        value result = std::move(values.back());
+        values.pop_back();
+        return result;
+    }
+
+    // canonical leaf sets, built on first use and then shared by reference
+    // from every occurrence. Indexed by De Bruijn index, SLC_none if unbuilt
+    static constexpr SLC_id SLC_none = UINT32_MAX;
+    SLC_id lambda_ = SLC_none;
+    std::vector<SLC_id> numbers_;
+
+    SLC_id make_number(int number) {
+        if (number >= static_cast<int>(numbers_.size()))
+            numbers_.resize(number + 1, SLC_none);
+        SLC_id &cached = numbers_[number];
+        if (cached != SLC_none)
+            return cached;
+        // 1 = {{{},{}}}
+        // 2 = {{{},{}}, {}}
+        // 3 = {{{},{}}, {}, {}}
+        // ...
+        SLC_ref empty{store_.intern(nullptr, 0)};
+        SLC_element base[2] = {empty, empty};
+        SLC_ref num_base{store_.intern(base, 2)};
+        // built once per number, later calls hit numbers_
+        std::vector<SLC_element> num_top(number, empty);
+        num_top[0] = num_base;
+        cached = store_.intern(num_top);
+        if constexpr (toposet_stats_enabled)
+            stats_.leaf_sets++;
+        return cached;
+    }
+
+    SLC_id make_lambda() {
+        if (lambda_ != SLC_none)
+            return lambda_;
+        // λ = {{}}
+        SLC_element empty = SLC_ref{store_.intern(nullptr, 0)};
+        lambda_ = store_.intern(&empty, 1);
+        if constexpr (toposet_stats_enabled)
+            stats_.leaf_sets++;
+        return lambda_;
+    }
+
+    // streaming output. stream() and stream_dbj() write the text convert()
+    // and convert_dbj() would produce straight from the AST, so no set is
+    // interned and memory is bounded by the input rather than the output.
+    // Sibling order needs the structure SLC_store::compare looks at, so a
+    // bottom up pass first records a set_key for every AST node. Sets with
+    // equal keys are written as equal, as the store would find them barring
+    // a 64 bit hash collision
+    struct set_key {
+        std::uint64_t hash;
+        std::uint32_t depth;
+        std::uint32_t count;
+    };
+
+    // an element of a set being written, or a piece of punctuation
+    struct item {
+        enum : std::uint8_t {
+            LAMBDA,
+            NUMBER,  // value is the De Bruijn index
+            NODE,    // value is the AST id of a definition or application
+            PROMOTE, // value is an application, the set holding its left
+            BASE,    // {{}, {}}, the set every number is built on
+            EMPTY,
+            SEPARATOR,
+            CLOSE,
+        } kind;
+        std::uint32_t value;
+    };
+
+    bool stream_slc_ = true;
+    std::vector<set_key> keys_;
+    // hashes of number sets with k leading {} before the {{}, {}} base
+    std::vector<std::uint64_t> number_prefix_;
+    std::vector<item> items_;
+
+    template <typename Sink> void stream(Sink &&sink) {
+        stream_slc_ = true;
+        stream_items(sink);
+    }
+
+    template <typename Sink> void stream_dbj(Sink &&sink) {
+        stream_slc_ = false;
+        stream_items(sink);
+    }
+
+    std::uint32_t ast_id(const ULC_AST_node *node) const {
+        return static_cast<std::uint32_t>(node - ast_.nodes_.data());
+    }
+
+    item item_of(const ULC_AST_node *node) const {
+        node = skip_groups(node);
+        if (!node)
+            return {item::EMPTY, 0};
+        if (node->type == ULC_AST_type::ATOMIC)
+            return {item::NUMBER, static_cast<std::uint32_t>(node->index)};
+        return {item::NODE, ast_id(node)};
+    }
+
+    // SLC_element alternative an item stands for
+    size_t variant_index(const item &it) const {
+        if (!stream_slc_ && it.kind == item::LAMBDA)
+            return 0;
+        if (!stream_slc_ && it.kind == item::NUMBER)
+            return 2;
+        return 1;
+    }
+
+    set_key key_of(const item &it) {
+        std::uint64_t empty = SLC_store::empty_hash;
+        switch (it.kind) {
+        case item::LAMBDA:
+            // {{}}
+            return {SLC_store::mix(SLC_store::mix(empty, 1), empty), 2, 1};
+        case item::NUMBER:
+            return number_key(it.value);
+        case item::NODE:
+            return keys_[it.value];
+        case item::PROMOTE: {
+            item left = item_of(ast_.get(ast_.nodes_[it.value].left));
+            return key_from(&left, 1);
+        }
+        case item::BASE: {
+            item empties[2] = {{item::EMPTY, 0}, {item::EMPTY, 0}};
+            return key_from(empties, 2);
+        }
+        default:
+            return {empty, 1, 0};
+        }
+    }
+
+    // {} repeated index - 1 times then {{}, {}}, see make_number
+    set_key number_key(std::uint32_t index) {
+        std::uint64_t empty = SLC_store::empty_hash;
+        if (number_prefix_.empty())
+            number_prefix_.push_back(empty);
+        while (number_prefix_.size() < index)
+            number_prefix_.push_back(SLC_store::mix(
+                SLC_store::mix(number_prefix_.back(), 1), empty));
+        std::uint64_t base = key_of({item::BASE, 0}).hash;
+        std::uint64_t hash = number_prefix_[index - 1];
+        hash = SLC_store::mix(SLC_store::mix(hash, 1), base);
+        return {hash, 3, index};
+    }
+
+    // SLC_store::compare over items
+    int compare_items(const item &a, const item &b) {
+        size_t ia = variant_index(a);
+        size_t ib = variant_index(b);
+        if (ia != ib)
+            return ia < ib ? -1 : 1;
+        if (ia == 0)
+            return 0;
+        if (ia == 2)
+            return a.value < b.value ? -1 : (a.value > b.value ? 1 : 0);
+        set_key ka = key_of(a);
+        set_key kb = key_of(b);
+        if (ka.depth != kb.depth)
+            return ka.depth < kb.depth ? -1 : 1;
+        if (ka.count != kb.count)
+            return ka.count < kb.count ? -1 : 1;
+        if (ka.hash != kb.hash)
+            return ka.hash < kb.hash ? -1 : 1;
+        return 0;
+    }
+
+    // elements of a NODE or PROMOTE item in canonical order
+    size_t elements_of(const item &it, item out[2]) {
+        const ULC_AST_node &node = ast_.nodes_[it.value];
+        if (it.kind == item::PROMOTE) {
+            out[0] = item_of(ast_.get(node.left));
+            return 1;
+        }
+        if (node.type == ULC_AST_type::DEFINITION) {
+            out[0] = {item::LAMBDA, 0};
+            out[1] = item_of(ast_.get(node.left));
+        } else {
+            out[0] = item_of(ast_.get(node.right));
+            out[1] = {item::PROMOTE, it.value};
+        }
+        if (compare_items(out[1], out[0]) < 0)
+            std::swap(out[0], out[1]);
+        return 2;
+    }
+
+    // the hash, depth and count SLC_store::intern gives sorted elems
+    set_key key_from(const item *elems, size_t count) {
+        set_key key{SLC_store::empty_hash, 1,
+                    static_cast<std::uint32_t>(count)};
+        for (size_t i = 0; i < count; i++) {
+            size_t index = variant_index(elems[i]);
+            key.hash = SLC_store::mix(key.hash, index);
+            if (index == 0) {
+                for (unsigned char ch : std::string_view("λ"))
+                    key.hash = SLC_store::mix(key.hash, ch);
+            } else if (index == 2) {
+                key.hash = SLC_store::mix(key.hash, elems[i].value);
+            } else {
+                set_key child = key_of(elems[i]);
+                key.hash = SLC_store::mix(key.hash, child.hash);
+                key.depth = std::max(key.depth, child.depth + 1);
+            }
+        }
+        return key;
+    }
+
+    // post order pass filling keys_ for every definition and application
+    void build_keys(const ULC_AST_node *root) {
+        keys_.resize(ast_.nodes_.size());
+        stack_.clear();
+        stack_.push_back({skip_groups(root), false});
+        while (!stack_.empty()) {
+            poll();
+            frame f = stack_.back();
+            stack_.pop_back();
+            if (!f.expanded) {
+                expand(f.node);
+                continue;
+            }
+            if (!f.node)
+                continue;
+            if (f.node->type == ULC_AST_type::ATOMIC)
+                throw std::runtime_error("Huh??");
+            item elems[2];
+            item it{item::NODE, ast_id(f.node)};
+            size_t count = elements_of(it, elems);
+            keys_[it.value] = key_from(elems, count);
+        }
+    }
+
+    template <typename Sink>
+    void write_number(std::uint32_t index, Sink &sink) {
+        if (!stream_slc_) {
+            char buf[16];
+            auto res = std::to_chars(buf, buf + sizeof(buf), index);
+            sink(buf, res.ptr - buf);
+            return;
+        }
+        static constexpr std::string_view empties =
+            "{}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, ";
+        sink("{", 1);
+        for (size_t left = index - 1; left;) {
+            size_t n = std::min<size_t>(left, empties.size() / 4);
+            sink(empties.data(), 4 * n);
+            left -= n;
+        }
+        sink("{{}, {}}}", 9);
+    }
+
+    // writes the loaded term, closed subterms found in reuse are copied
+    // from it instead of being written out. The root is looked up by the
+    // caller, see convert_cached
+    template <typename Sink>
+    void stream_items(Sink &out, ULC_cache *reuse = nullptr) {
+        {
+            toposet_timer timer(stats_.serialize_ns);
+            build_keys(ast_.root());
+        }
+        write_items(item_of(ast_.root()), out, reuse);
+    }
+
+    // writes the set of start and everything below it, keys_ must be built
+    template <typename Sink>
+    void write_items(item start, Sink &out, ULC_cache *reuse = nullptr) {
+        toposet_timer timer(stats_.serialize_ns);
+        auto sink = [&](const char *data, size_t len) {
+            if constexpr (toposet_stats_enabled)
+                stats_.bytes_emitted += len;
+            out(data, len);
+        };
+        items_.clear();
+        items_.push_back(start);
+        std::uint32_t root = start.value;
+        while (!items_.empty()) {
+            poll();
+            item it = items_.back();
+            items_.pop_back();
+            switch (it.kind) {
+            case item::SEPARATOR:
+                sink(", ", 2);
+                break;
+            case item::CLOSE:
+                sink("}", 1);
+                break;
+            case item::EMPTY:
+                sink("{}", 2);
+                break;
+            case item::BASE:
+                sink("{{}, {}}", 8);
+                break;
+            case item::LAMBDA:
+                if (stream_slc_)
+                    sink("{{}}", 4);
+                else
+                    sink("λ", 2);
+                break;
+            case item::NUMBER:
+                write_number(it.value, sink);
+                break;
+            default: {
+                if (reuse && it.kind == item::NODE && it.value != root) {
+                    const term_key &key = term_keys_[it.value];
+                    if (key.free == 0 &&
+                        key.end - key.begin >= ULC_cache_min_words) {
+                        if (const std::string *text =
+                                find_cached(*reuse, key)) {
+                            sink(text->data(), text->size());
+                            break;
+                        }
+                    }
+                }
+                item elems[2];
+                size_t count = elements_of(it, elems);
+                sink("{", 1);
+                items_.push_back({item::CLOSE, 0});
+                for (size_t i = count; i-- > 0;) {
+                    items_.push_back(elems[i]);
+                    if (i)
+                        items_.push_back({item::SEPARATOR, 0});
+                }
+            }
+            }
+        }
+    }
+
+    // name free form of the loaded term for ULC_cache: terms_ holds its
+    // pre-order words and term_keys_ the slice of every definition and
+    // application, with a hash of the slice and the largest De Bruijn index
+    // escaping it, 0 when the subterm is closed
+    struct term_key {
+        std::uint64_t hash;
+        std::uint32_t begin;
+        std::uint32_t end;
+        std::uint32_t free;
+    };
+
+    std::vector<std::uint32_t> terms_;
+    std::vector<term_key> term_keys_;
+
+    void build_terms(const ULC_AST_node *root) {
+        std::uint64_t empty = SLC_store::empty_hash;
+        // hash and escaping index of a child, whatever its kind
+        auto child_key = [&](const ULC_AST_node *child) -> term_key {
+            if (!child)
+                return {SLC_store::mix(empty, 2), 0, 0, 0};
+            if (child->type == ULC_AST_type::ATOMIC) {
+                std::uint32_t index = static_cast<std::uint32_t>(child->index);
+                return {SLC_store::mix(empty, index + 2), 0, 0, index};
+            }
+            return term_keys_[ast_id(child)];
+        };
+        terms_.clear();
+        term_keys_.resize(ast_.nodes_.size());
+        stack_.clear();
+        stack_.push_back({skip_groups(root), false});
+        while (!stack_.empty()) {
+            poll();
+            if (stack_.size() >= max_depth_)
+                throw std::runtime_error("Expression nested too deeply");
+            frame f = stack_.back();
+            stack_.pop_back();
+            const ULC_AST_node *node = f.node;
+            if (!node || node->type == ULC_AST_type::ATOMIC) {
+                terms_.push_back(
+                    node ? static_cast<std::uint32_t>(node->index) + 2 : 2);
+                continue;
+            }
+            term_key &key = term_keys_[ast_id(node)];
+            const ULC_AST_node *left = skip_groups(ast_.get(node->left));
+            const ULC_AST_node *right =
+                node->type == ULC_AST_type::APPLICATION
+                    ? skip_groups(ast_.get(node->right))
+                    : nullptr;
+            if (!f.expanded) {
+                key.begin = static_cast<std::uint32_t>(terms_.size());
+                terms_.push_back(node->type == ULC_AST_type::APPLICATION);
+                stack_.push_back({node, true});
+                if (node->type == ULC_AST_type::APPLICATION)
+                    stack_.push_back({right, false});
+                stack_.push_back({left, false});
+                continue;
+            }
+            key.end = static_cast<std::uint32_t>(terms_.size());
+            term_key body = child_key(left);
+            if (node->type == ULC_AST_type::DEFINITION) {
+                key.hash = SLC_store::mix(SLC_store::mix(empty, 0), body.hash);
+                key.free = body.free > 0 ? body.free - 1 : 0;
+            } else {
+                term_key arg = child_key(right);
+                key.hash = SLC_store::mix(
+                    SLC_store::mix(SLC_store::mix(empty, 1), body.hash),
+                    arg.hash);
+                key.free = std::max(body.free, arg.free);
+            }
+        }
+    }
+
+    // cached text of the term behind key, counted in the stats
+    const std::string *find_cached(ULC_cache &cache, const term_key &key) {
+        const std::string *text = cache.find(
+            key.hash, terms_.data() + key.begin, key.end - key.begin);
+        if constexpr (toposet_stats_enabled)
+            (text ? stats_.cache_hits : stats_.cache_misses)++;
+        return text;
+    }
+
+    // text of the loaded term in either target through cache. A whole term
+    // hit is copied out, anything else is streamed with cached subterms
+    // spliced in and then added to cache
+    std::string convert_cached(ULC_cache &cache, bool slc) {
+        std::string out;
+        auto append = [&out](const char *data, size_t len) {
+            out.append(data, len);
+        };
+        stream_slc_ = slc;
+        const ULC_AST_node *root = skip_groups(ast_.root());
+        if (!root) {
+            stream_items(append);
+            return out;
+        }
+        build_terms(root);
+        const term_key &key = term_keys_[ast_id(root)];
+        const std::uint32_t *words = terms_.data() + key.begin;
+        size_t len = key.end - key.begin;
+        if (const std::string *text = find_cached(cache, key)) {
+            if constexpr (toposet_stats_enabled)
+                stats_.bytes_emitted += text->size();
+            return *text;
+        }
+        stream_items(append, &cache);
+        cache.insert(key.hash, words, len, out);
+        return out;
+    }
+
+    // interned set of a streaming item, the subtree of a node is converted
+    // with convert_subset and leaves are the shared leaf sets
+    SLC_id intern_item(const item &it) {
+        switch (it.kind) {
+        case item::LAMBDA:
+            return make_lambda();
+        case item::NUMBER:
+            return make_number(static_cast<int>(it.value));
+        case item::NODE:
+            return convert_subset(&ast_.nodes_[it.value]);
+        case item::PROMOTE: {
+            item left = item_of(ast_.get(ast_.nodes_[it.value].left));
+            SLC_element elem = SLC_ref{intern_item(left)};
+            return store_.intern(&elem, 1);
+        }
+        case item::BASE: {
+            SLC_element empty = SLC_ref{store_.intern(nullptr, 0)};
+            SLC_element pair[2] = {empty, empty};
+            return store_.intern(pair, 2);
+        }
+        default:
+            return store_.intern(nullptr, 0);
+        }
+    }
+
+    // lazy form of convert(). A set_view names the AST node or leaf a set
+    // comes from and works out its elements, in the order SLC_store keeps
+    // them, only when they are asked for. Numbers stay a De Bruijn index
+    // until enumerated, so sets nobody looks at cost nothing. The order
+    // needs the keys of the streaming output, built by view() in one pass
+    // over the AST. Views are valid until the next load() and are
+    // invalidated by stream(), stream_dbj() and convert_cached(), which
+    // rebuild those keys
+    struct set_view {
+        ULC_converter *converter;
+        item it;
+
+        // the element count, hash and depth materialize() will intern
+        std::uint32_t size() const { return converter->key_of(it).count; }
+        std::uint64_t hash() const { return converter->key_of(it).hash; }
+        std::uint32_t depth() const { return converter->key_of(it).depth; }
+
+        // element i < size(), views of the elements of materialize() in
+        // the same order
+        set_view operator[](size_t i) const {
+            switch (it.kind) {
+            case item::NUMBER:
+                // {} repeated index - 1 times, then {{}, {}}
+                return {converter,
+                        {i + 1 < it.value ? item::EMPTY : item::BASE, 0}};
+            case item::LAMBDA:
+            case item::BASE:
+                return {converter, {item::EMPTY, 0}};
+            case item::NODE:
+            case item::PROMOTE: {
+                item elems[2];
+                converter->elements_of(it, elems);
+                return {converter, elems[i]};
+            }
+            default:
+                throw std::runtime_error("Element of an empty set");
+            }
+        }
+
+        // interns this set and everything below it into the converter's
+        // store. Every call converts the subtree again, the store hands
+        // back the same set
+        SLC_set materialize() const {
+            toposet_timer timer(converter->stats_.convert_ns);
+            size_t sets = converter->store_.size();
+            SLC_id id = converter->intern_item(it);
+            converter->record_sets(sets, id);
+            return {&converter->store_, id};
+        }
+
+        // writes the text of materialize() through sink(data, len) straight
+        // from the AST, as stream() does
+        template <typename Sink> void serialize(Sink &&sink) const {
+            converter->write_items(it, sink);
+        }
+
+        std::string to_string() const {
+            std::string out;
+            serialize([&out](const char *data, size_t len) {
+                out.append(data, len);
+            });
+            return out;
+        }
+    };
+
+    set_view view() {
+        toposet_timer timer(stats_.convert_ns);
+        stream_slc_ = true;
+        build_keys(ast_.root());
+        return {this, item_of(ast_.root())};
+    }
+};
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ulc_converter.hpp"
+
+// beta reduction of resolved ASTs to normal form, so programs can be
+// normalized before their topology is emitted. Terms are never copied or
+// substituted: an argument becomes a thunk holding its term and environment,
+// environments are shared linked lists of thunks, and the normal form is read
+// back from the resulting graph into a fresh ULC_AST
+enum class ULC_strategy {
+    // leftmost outermost, every use of an argument evaluates it again
+    NORMAL_ORDER,
+    // the same order, but an argument is evaluated at most once and the
+    // result shared by every use
+    CALL_BY_NEED,
+};
+
+// default bounds on beta steps and on the bytes held by the reduction graph
+constexpr size_t ULC_reduce_steps = 10000000;
+constexpr size_t ULC_reduce_bytes = 256 << 20;
+
+struct ULC_reducer {
+    static constexpr std::uint32_t none = UINT32_MAX;
+
+    ULC_strategy strategy_;
+    size_t max_steps_;
+    size_t max_bytes_;
+    // beta steps taken by the last reduce()
+    size_t steps_ = 0;
+    ULC_AST out_;
+
+    ULC_reducer(ULC_strategy strategy = ULC_strategy::CALL_BY_NEED,
+                size_t max_steps = ULC_reduce_steps,
+                size_t max_bytes = ULC_reduce_bytes)
+        : strategy_(strategy), max_steps_(max_steps), max_bytes_(max_bytes) {}
+
+    // normal form of the term at ast's root into out_. ast must come from
+    // ULC_parser and stay unchanged until reduce returns
+    const ULC_AST &reduce(const ULC_AST &ast) {
+        ast_ = &ast;
+        steps_ = 0;
+        thunks_.clear();
+        links_.clear();
+        values_.clear();
+        out_.clear();
+        std::uint32_t root = make_thunk(ast.root(), none);
+        read_back(root);
+        return out_;
+    }
+
+  private:
+    // a suspended term, value is its weak head normal form once known
+    struct thunk {
+        const ULC_AST_node *term;
+        std::uint32_t env;
+        std::uint32_t value;
+    };
+
+    // cell of an environment, innermost binder first, or of the arguments
+    // of a neutral term, last argument first
+    struct link {
+        std::uint32_t thunk;
+        std::uint32_t next;
+    };
+
+    // weak head normal forms. A closure is a definition and its environment,
+    // a neutral term is a bound variable, identified by the binder depth
+    // that introduced it during read back, applied to args. An empty group
+    // is inert and becomes a neutral term with level none
+    struct value {
+        const ULC_AST_node *closure;
+        std::uint32_t env;
+        std::uint32_t level;
+        std::uint32_t args;
+    };
+
+    // pending work of the evaluation stack
+    struct frame {
+        enum : std::uint8_t { ARG, UPDATE } kind;
+        std::uint32_t thunk;
+    };
+
+    // read back of thunk at binder depth into a child slot of node
+    struct task {
+        std::uint32_t thunk;
+        std::uint32_t depth;
+        ULC_AST_id node;
+        enum : std::uint8_t { ROOT, LEFT, RIGHT } slot;
+    };
+
+    const ULC_AST *ast_ = nullptr;
+    std::vector<thunk> thunks_;
+    std::vector<link> links_;
+    std::vector<value> values_;
+    std::vector<frame> stack_;
+    std::vector<task> tasks_;
+
+    size_t bytes() const {
+        return thunks_.size() * sizeof(thunk) + links_.size() * sizeof(link) +
+               values_.size() * sizeof(value) +
+               stack_.size() * sizeof(frame) + tasks_.size() * sizeof(task) +
+               out_.nodes_.size() * sizeof(ULC_AST_node);
+    }
+
+    void check_limits() {
+        if (steps_ > max_steps_)
+            throw std::runtime_error("Reduction step limit reached");
+        if (bytes() > max_bytes_)
+            throw std::runtime_error("Reduction memory limit reached");
+    }
+
+    const ULC_AST_node *skip_groups(const ULC_AST_node *node) const {
+        while (node && node->type == ULC_AST_type::GROUP)
+            node = ast_->get(node->right);
+        return node;
+    }
+
+    std::uint32_t make_thunk(const ULC_AST_node *term, std::uint32_t env) {
+        thunks_.push_back({skip_groups(term), env, none});
+        return static_cast<std::uint32_t>(thunks_.size() - 1);
+    }
+
+    std::uint32_t make_link(std::uint32_t thunk, std::uint32_t next) {
+        links_.push_back({thunk, next});
+        return static_cast<std::uint32_t>(links_.size() - 1);
+    }
+
+    std::uint32_t make_value(value v) {
+        values_.push_back(v);
+        return static_cast<std::uint32_t>(values_.size() - 1);
+    }
+
+    // thunk of the variable with De Bruijn index in env
+    std::uint32_t lookup(std::uint32_t env, int index) const {
+        for (; index > 1; index--)
+            env = links_[env].next;
+        return links_[env].thunk;
+    }
+
+    // weak head normal form of thunk t. Arguments wait on the stack for the
+    // definition they are passed to, and under call by need every forced
+    // thunk gets an update frame that stores its value once it is reached
+    std::uint32_t whnf(std::uint32_t t) {
+        if (thunks_[t].value != none)
+            return thunks_[t].value;
+        bool share = strategy_ == ULC_strategy::CALL_BY_NEED;
+        stack_.clear();
+        if (share)
+            stack_.push_back({frame::UPDATE, t});
+        const ULC_AST_node *term = thunks_[t].term;
+        std::uint32_t env = thunks_[t].env;
+        while (true) {
+            std::uint32_t v = none;
+            if (!term) {
+                v = make_value({nullptr, none, none, none});
+            } else if (term->type == ULC_AST_type::ATOMIC) {
+                std::uint32_t var = lookup(env, term->index);
+                if (thunks_[var].value != none) {
+                    v = thunks_[var].value;
+                } else {
+                    if (share)
+                        stack_.push_back({frame::UPDATE, var});
+                    term = thunks_[var].term;
+                    env = thunks_[var].env;
+                    continue;
+                }
+            } else if (term->type == ULC_AST_type::APPLICATION) {
+                if (stack_.size() >= ULC_max_depth)
+                    throw std::runtime_error("Reduction nested too deeply");
+                stack_.push_back(
+                    {frame::ARG, make_thunk(ast_->get(term->right), env)});
+                term = skip_groups(ast_->get(term->left));
+                continue;
+            } else if (!stack_.empty() && stack_.back().kind == frame::ARG) {
+                // beta step straight from the definition
+                env = make_link(stack_.back().thunk, env);
+                stack_.pop_back();
+                term = skip_groups(ast_->get(term->left));
+                steps_++;
+                check_limits();
+                continue;
+            } else {
+                v = make_value({term, env, none, none});
+            }
+
+            // v is a value, hand it to the frames waiting on it
+            while (!stack_.empty()) {
+                frame f = stack_.back();
+                if (f.kind == frame::UPDATE) {
+                    thunks_[f.thunk].value = v;
+                    stack_.pop_back();
+                    continue;
+                }
+                const value &head = values_[v];
+                if (head.closure)
+                    break;
+                std::uint32_t args = make_link(f.thunk, head.args);
+                v = make_value({nullptr, none, head.level, args});
+                stack_.pop_back();
+            }
+            if (stack_.empty())
+                return v;
+            // a closure applied to the argument on top
+            const value &head = values_[v];
+            env = make_link(stack_.back().thunk, head.env);
+            stack_.pop_back();
+            term = skip_groups(ast_->get(head.closure->left));
+            steps_++;
+            check_limits();
+        }
+    }
+
+    ULC_AST_id add_node(ULC_AST_node node, const task &at) {
+        ULC_AST_id id = out_.add(node);
+        if (at.slot == task::ROOT)
+            out_.root_ = id;
+        else if (at.slot == task::LEFT)
+            out_[at.node].left = id;
+        else
+            out_[at.node].right = id;
+        return id;
+    }
+
+    // normal form of thunk root as ULC_AST nodes, outermost first. Each
+    // definition is entered with a fresh neutral variable bound to its
+    // binder depth, which becomes a De Bruijn index again when printed
+    void read_back(std::uint32_t root) {
+        tasks_.clear();
+        tasks_.push_back({root, 0, ULC_AST_null, task::ROOT});
+        while (!tasks_.empty()) {
+            task at = tasks_.back();
+            tasks_.pop_back();
+            check_limits();
+            value v = values_[whnf(at.thunk)];
+            if (v.closure) {
+                ULC_AST_id node =
+                    add_node(ULC_AST_node(ULC_AST_type::DEFINITION), at);
+                std::uint32_t fresh = make_thunk(nullptr, none);
+                thunks_[fresh].value =
+                    make_value({nullptr, none, at.depth, none});
+                std::uint32_t body = make_thunk(
+                    ast_->get(v.closure->left), make_link(fresh, v.env));
+                tasks_.push_back({body, at.depth + 1, node, task::LEFT});
+                continue;
+            }
+            // the arguments, last first, become a left leaning chain
+            for (std::uint32_t arg = v.args; arg != none;
+                 arg = links_[arg].next) {
+                ULC_AST_id node =
+                    add_node(ULC_AST_node(ULC_AST_type::APPLICATION), at);
+                tasks_.push_back(
+                    {links_[arg].thunk, at.depth, node, task::RIGHT});
+                at = {none, at.depth, node, task::LEFT};
+            }
+            if (v.level == none)
+                continue;
+            ULC_AST_node var(ULC_AST_type::ATOMIC);
+            var.index = static_cast<int>(at.depth - v.level);
+            add_node(var, at);
+        }
+    }
+};
+
+// lambda text of a resolved AST with every binder at depth d named xd, so
+// the result parses back to the same term
+inline std::string ULC_to_string(const ULC_AST &ast) {
+    struct piece {
+        const ULC_AST_node *node;
+        // text to write instead of a node when node is nullptr and text set
+        const char *text;
+        std::uint32_t depth;
+        // what the node sits in, which decides its parentheses
+        enum : std::uint8_t { TOP, FUNCTION, ARGUMENT } role;
+    };
+    auto skip_groups = [&](const ULC_AST_node *node) {
+        while (node && node->type == ULC_AST_type::GROUP)
+            node = ast.get(node->right);
+        return node;
+    };
+    std::string out;
+    std::vector<piece> stk;
+    stk.push_back({skip_groups(ast.root()), nullptr, 0, piece::TOP});
+    while (!stk.empty()) {
+        piece p = stk.back();
+        stk.pop_back();
+        if (p.text) {
+            out += p.text;
+            continue;
+        }
+        const ULC_AST_node *node = p.node;
+        if (!node) {
+            out += "()";
+            continue;
+        }
+        if (node->type == ULC_AST_type::ATOMIC) {
+            out += 'x';
+            out += std::to_string(p.depth - node->index);
+            continue;
+        }
+        bool definition = node->type == ULC_AST_type::DEFINITION;
+        bool wrap = p.role == piece::ARGUMENT ||
+                    (definition && p.role == piece::FUNCTION);
+        if (wrap) {
+            out += '(';
+            stk.push_back({nullptr, ")", 0, piece::TOP});
+        }
+        if (definition) {
+            out += "\\x";
+            out += std::to_string(p.depth);
+            out += '.';
+            stk.push_back({skip_groups(ast.get(node->left)), nullptr,
+                           p.depth + 1, piece::TOP});
+        } else {
+            stk.push_back({skip_groups(ast.get(node->right)), nullptr, p.depth,
+                           piece::ARGUMENT});
+            stk.push_back({nullptr, " ", 0, piece::TOP});
+            stk.push_back({skip_groups(ast.get(node->left)), nullptr, p.depth,
+                           piece::FUNCTION});
+        }
+    }
+    return out;
+}
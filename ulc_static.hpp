@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ulc_converter.hpp"
+
+// fixed combinators with their ulc2dbj / ulc2slc text. The text is worked out
+// by ULC_converter itself the first time the table is used, so it is always
+// byte for byte what a runtime conversion returns and there is no second
+// implementation of the pipeline to keep in line with the first
+struct ULC_combinator {
+    std::string_view name;
+    std::string_view term;
+    std::string dbj;
+    std::string slc;
+};
+
+inline constexpr std::string_view ULC_I = "\\x.x";
+inline constexpr std::string_view ULC_K = "\\x.\\y.x";
+inline constexpr std::string_view ULC_S = "\\x.\\y.\\z.((x z)(y z))";
+inline constexpr std::string_view ULC_Y = "\\f.((\\x.f(x x)) (\\x.f(x x)))";
+
+inline const std::vector<ULC_combinator> &ULC_combinators() {
+    // thread safe one time initialization
+    static const std::vector<ULC_combinator> table = [] {
+        std::vector<ULC_combinator> out = {
+            {"I", ULC_I, {}, {}},
+            {"K", ULC_K, {}, {}},
+            {"S", ULC_S, {}, {}},
+            {"Y", ULC_Y, {}, {}},
+        };
+        ULC_converter converter;
+        for (ULC_combinator &combinator : out) {
+            converter.load(combinator.term);
+            ULC_conversion result = converter.convert_both();
+            converter.serialize(result.dbj, combinator.dbj);
+            converter.serialize(result.slc, combinator.slc);
+        }
+        return out;
+    }();
+    return table;
+}
+
+// table entry whose term is exactly text, nullptr if there is none
+inline const ULC_combinator *ULC_static_lookup(std::string_view text) {
+    for (const ULC_combinator &combinator : ULC_combinators()) {
+        if (combinator.term == text)
+            return &combinator;
+    }
+    return nullptr;
+}